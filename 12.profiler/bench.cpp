@@ -0,0 +1,180 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Records are only written when PROFILER_OUTPUT or PROFILER_TRACE asks
+#define PROFILER_DEFAULT_OUTPUT nullptr
+#include "profiler.h"
+
+#include <benchmark/benchmark.h>
+
+// PrintfSink measures formatting and stdio, not the terminal
+static FILE *const null_stream = [] {
+  FILE *stream = fopen("/dev/null", "w");
+  profiler::PrintfSink::stream = stream;
+  return stream;
+}();
+
+/*
+ *
+ * Clock read cost
+ *
+ */
+static void clock_high_resolution(benchmark::State &state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(std::chrono::high_resolution_clock::now());
+  }
+}
+
+static void clock_profiler(benchmark::State &state) {
+  state.SetLabel(profiler::Clock::invariant_tsc() ? "tsc" : "clock_gettime");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(profiler::Clock::now());
+  }
+}
+
+BENCHMARK(clock_high_resolution);
+BENCHMARK(clock_profiler);
+
+/*
+ *
+ * Per scope overhead of each sink
+ *
+ */
+static void profile_scope_printf(benchmark::State &state) {
+  for (auto _ : state) {
+    PROFILE_WITH(profiler::PrintfSink);
+  }
+}
+
+static void profile_scope_ring_buffer(benchmark::State &state) {
+  const uint64_t dropped_before = profiler::TraceFlusher::instance().dropped();
+
+  for (auto _ : state) {
+    PROFILE_WITH(profiler::RingBufferSink);
+  }
+
+  state.counters["dropped"] =
+      profiler::TraceFlusher::instance().dropped() - dropped_before;
+}
+
+static void profile_scope_aggregate(benchmark::State &state) {
+  for (auto _ : state) {
+    PROFILE_WITH(profiler::AggregateSink);
+  }
+}
+
+static void profile_scope_counters(benchmark::State &state) {
+  state.SetLabel(profiler::PerfCounters::local().valid() ? "perf"
+                                                         : "unsupported");
+  for (auto _ : state) {
+    PROFILE_COUNTERS_WITH(profiler::AggregateSink);
+  }
+}
+
+// 1 in 64 scopes reach the sink
+static void profile_scope_sampled(benchmark::State &state) {
+  for (auto _ : state) {
+    PROFILE_SAMPLED_WITH(profiler::AggregateSink, 64, 0);
+  }
+}
+
+static void profile_scope_disabled(benchmark::State &state) {
+  bool disabled = false;
+  for (auto _ : state) {
+    PROFILE_WITH(profiler::AggregateSink);
+    if (!disabled) {
+      const uint32_t id = profiler::SiteRegistry::find(__FUNCTION__);
+      profiler::SiteRegistry::slot(id).set_enabled(false);
+      disabled = true;
+    }
+  }
+}
+
+BENCHMARK(profile_scope_printf);
+BENCHMARK(profile_scope_ring_buffer);
+BENCHMARK(profile_scope_aggregate);
+BENCHMARK(profile_scope_counters);
+BENCHMARK(profile_scope_sampled);
+BENCHMARK(profile_scope_disabled);
+
+/*
+ *
+ * Overhead per scope by nesting depth and by concurrently profiling threads
+ *
+ */
+template <typename Sink> __attribute_noinline__ void nested_scopes(int depth) {
+  PROFILE_WITH(Sink);
+  if (depth > 1) {
+    nested_scopes<Sink>(depth - 1);
+  }
+  benchmark::ClobberMemory();
+}
+
+template <typename Sink> static void profile_nested(benchmark::State &state) {
+  const int depth = state.range(0);
+  for (auto _ : state) {
+    nested_scopes<Sink>(depth);
+  }
+  state.SetItemsProcessed(state.iterations() * depth);
+}
+
+#define BENCH_SINK(sink)                                                       \
+  BENCHMARK_TEMPLATE(profile_nested, sink)->DenseRange(1, 16, 1);              \
+  BENCHMARK_TEMPLATE(profile_nested, sink)                                     \
+      ->Arg(1)                                                                 \
+      ->Arg(8)                                                                 \
+      ->ThreadRange(1, 32)                                                     \
+      ->UseRealTime();
+
+BENCH_SINK(profiler::PrintfSink);
+BENCH_SINK(profiler::RingBufferSink);
+BENCH_SINK(profiler::AggregateSink);
+
+/*
+ *
+ * Aggregating mode on the test function from main.cpp
+ *
+ */
+template <typename Sink>
+__attribute_noinline__ uint64_t do_something(uint64_t break_val) {
+  PROFILE_WITH(Sink);
+
+  uint64_t res = (uint64_t(std::sqrt(break_val)) >> 1) + 1;
+  res = (uint64_t(std::sqrt(res)) << 1) + 1;
+  res = (uint64_t(std::sqrt(res)) >> 1) + 1;
+  res = (uint64_t(std::sqrt(res)) << 1) + 1;
+
+  return res;
+}
+
+static constexpr int64_t CALLS_PER_ITERATION{1000000};
+
+static void profile_do_something_aggregate(benchmark::State &state) {
+  uint64_t br = 10000000000;
+  for (auto _ : state) {
+    for (int64_t i = 0; i < CALLS_PER_ITERATION; ++i) {
+      br = do_something<profiler::AggregateSink>(br + i);
+      benchmark::DoNotOptimize(br);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * CALLS_PER_ITERATION);
+
+  const auto summaries = profiler::StatsAggregator::instance().summaries();
+  for (uint32_t id = 0; id < summaries.size(); ++id) {
+    if (strcmp(profiler::SiteRegistry::get(id).function, "do_something") ==
+        0) {
+      const auto &summary = summaries[id];
+      state.counters["p50_ns"] =
+          profiler::Clock::to_ns(summary.percentile(0.5));
+      state.counters["p99_ns"] =
+          profiler::Clock::to_ns(summary.percentile(0.99));
+    }
+  }
+}
+
+BENCHMARK(profile_do_something_aggregate)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
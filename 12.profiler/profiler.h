@@ -0,0 +1,1200 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cpuid.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+namespace profiler {
+
+/*
+ *
+ * Clock
+ *
+ * Reads the TSC directly when the CPU reports an invariant TSC (constant
+ * rate, keeps ticking in deep C-states), otherwise clock_gettime. Ticks are
+ * converted with a rate calibrated against CLOCK_MONOTONIC at startup.
+ *
+ */
+class Clock {
+public:
+  static constexpr std::chrono::milliseconds CALIBRATION_TIME{10};
+
+  static uint64_t now() { return state().tsc ? __rdtsc() : monotonic_ns(); }
+
+  // rdtscp waits for the scope's instructions to retire before reading
+  static uint64_t now_end() {
+    unsigned int aux;
+    return state().tsc ? __rdtscp(&aux) : monotonic_ns();
+  }
+
+  static bool invariant_tsc() { return state().tsc; }
+
+  static double ticks_per_ns() { return state().ticks_per_ns; }
+
+  static double to_ns(uint64_t ticks) {
+    return double(ticks) / state().ticks_per_ns;
+  }
+
+private:
+  struct Calibration {
+    bool tsc;
+    double ticks_per_ns;
+  };
+
+  static uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+  }
+
+  static bool has_invariant_tsc() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+      return false;
+    }
+    return edx & (1u << 8);
+  }
+
+  static Calibration calibrate() {
+    if (!has_invariant_tsc()) {
+      return {false, 1.0};
+    }
+
+    const uint64_t start_ns = monotonic_ns();
+    const uint64_t start_tick = __rdtsc();
+    const uint64_t calibration_ns =
+        std::chrono::nanoseconds(CALIBRATION_TIME).count();
+    uint64_t end_ns = start_ns;
+    while (end_ns - start_ns < calibration_ns) {
+      end_ns = monotonic_ns();
+    }
+    const uint64_t end_tick = __rdtsc();
+
+    return {true, double(end_tick - start_tick) / double(end_ns - start_ns)};
+  }
+
+  static const Calibration &state() {
+    static const Calibration calibration = calibrate();
+    return calibration;
+  }
+};
+
+/*
+ *
+ * Static call sites
+ *
+ * Every PROFILE() owns a constant initialized SiteSlot, so reaching it costs
+ * no static guard. The slot gets a 16 bit id from the registry on its first
+ * execution, records carry that id instead of the function/file/line
+ * pointers. Slots can be disabled and sampled at runtime, the sampling
+ * decision uses thread local state only.
+ *
+ */
+struct Site {
+  const char *function;
+  const char *file;
+  long line;
+};
+
+inline constexpr uint32_t MAX_SITES{4096};
+
+inline thread_local uint32_t t_sample_countdown[MAX_SITES];
+inline thread_local uint64_t t_sample_next_tick[MAX_SITES];
+
+class SiteSlot {
+public:
+  static constexpr uint32_t UNREGISTERED{UINT32_MAX};
+
+  constexpr SiteSlot(const char *function, const char *file, long line,
+                     uint32_t every_calls = 1, uint64_t every_ns = 0)
+      : m_site{function, file, line}, m_every_calls(every_calls),
+        m_every_ns(every_ns) {}
+
+  const Site &site() const { return m_site; }
+
+  uint16_t id() {
+    const uint32_t id = m_id.load(std::memory_order_acquire);
+    return id != UNREGISTERED ? uint16_t(id) : register_slot();
+  }
+
+  // Record 1 in every_calls executions and at most one per every_ns
+  void set_sampling(uint32_t every_calls, uint64_t every_ns) {
+    m_every_calls.store(every_calls ? every_calls : 1,
+                        std::memory_order_relaxed);
+    m_every_ticks.store(uint64_t(double(every_ns) * Clock::ticks_per_ns()),
+                        std::memory_order_relaxed);
+  }
+
+  void set_enabled(bool enabled) {
+    m_enabled.store(enabled, std::memory_order_relaxed);
+  }
+
+  bool sampled(uint16_t id) const {
+    if (!m_enabled.load(std::memory_order_relaxed)) {
+      return false;
+    }
+
+    const uint32_t every_calls = m_every_calls.load(std::memory_order_relaxed);
+    if (every_calls > 1) {
+      uint32_t &countdown = t_sample_countdown[id];
+      if (countdown != 0) {
+        --countdown;
+        return false;
+      }
+      countdown = every_calls - 1;
+    }
+
+    const uint64_t every_ticks = m_every_ticks.load(std::memory_order_relaxed);
+    if (every_ticks != 0) {
+      const uint64_t now = Clock::now();
+      uint64_t &next_tick = t_sample_next_tick[id];
+      if (now < next_tick) {
+        return false;
+      }
+      next_tick = now + every_ticks;
+    }
+    return true;
+  }
+
+private:
+  friend class SiteRegistry;
+
+  uint16_t register_slot();
+
+  const Site m_site;
+  std::atomic<uint32_t> m_id{UNREGISTERED};
+  std::atomic<bool> m_enabled{true};
+  std::atomic<uint32_t> m_every_calls;
+  std::atomic<uint64_t> m_every_ticks{0};
+  const uint64_t m_every_ns;
+};
+
+// Append only table of executed PROFILE() sites, an id stays valid for the
+// whole run
+class SiteRegistry {
+public:
+  static constexpr uint32_t NOT_FOUND{UINT32_MAX};
+
+  static const Site &get(uint32_t id) { return slot(id).site(); }
+
+  static SiteSlot &slot(uint32_t id) { return *instance().m_slots[id]; }
+
+  static uint32_t count() {
+    return instance().m_count.load(std::memory_order_acquire);
+  }
+
+  // First site in the given function, optionally at the given line
+  static uint32_t find(const char *function, long line = 0) {
+    for (uint32_t id = 0, l = count(); id < l; ++id) {
+      const Site &site = get(id);
+      if (strcmp(site.function, function) == 0 &&
+          (line == 0 || site.line == line)) {
+        return id;
+      }
+    }
+    return NOT_FOUND;
+  }
+
+private:
+  friend class SiteSlot;
+
+  static SiteRegistry &instance() {
+    static SiteRegistry registry;
+    return registry;
+  }
+
+  uint16_t add(SiteSlot &slot) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    // Another thread may have registered it while we waited
+    const uint32_t registered = slot.m_id.load(std::memory_order_relaxed);
+    if (registered != SiteSlot::UNREGISTERED) {
+      return uint16_t(registered);
+    }
+
+    const uint32_t id = m_count.load(std::memory_order_relaxed);
+    if (id == MAX_SITES) {
+      fprintf(stderr, "profiler: more than %u sites\n", MAX_SITES);
+      abort();
+    }
+    if (slot.m_every_ns != 0) {
+      slot.set_sampling(slot.m_every_calls.load(std::memory_order_relaxed),
+                        slot.m_every_ns);
+    }
+    m_slots[id] = &slot;
+    m_count.store(id + 1, std::memory_order_release);
+    slot.m_id.store(id, std::memory_order_release);
+    return uint16_t(id);
+  }
+
+  std::mutex m_lock;
+  std::atomic<uint32_t> m_count{0};
+  SiteSlot *m_slots[MAX_SITES];
+};
+
+__attribute__((noinline)) inline uint16_t SiteSlot::register_slot() {
+  return SiteRegistry::instance().add(*this);
+}
+
+/*
+ *
+ * Printf sink, one JSON line per scope exit
+ *
+ */
+struct PrintfSink {
+  static inline FILE *stream = stdout;
+
+  static void record(uint16_t site_id, uint32_t depth, uint64_t start,
+                     uint64_t end) {
+    const Site &site = SiteRegistry::get(site_id);
+    const auto thread_id = pthread_self();
+
+    fprintf(stream,
+            "{ \"thread\" : %lu, \"file\" : \"%s\", \"line\" : %ld, "
+            "\"function\" : \"%s\", \"depth\" : %u, \"duration\" : %.3f  "
+            "}\n",
+            thread_id, site.file, site.line, site.function, depth,
+            Clock::to_ns(end - start) / 1000.0);
+  }
+};
+
+/*
+ *
+ * Ring buffer sink, binary records flushed in bulk
+ *
+ */
+struct TraceRecord {
+  uint64_t start;
+  uint64_t end;
+  uint16_t site;
+  uint16_t thread;
+  uint16_t depth; // 0 for outermost scope of the thread
+  uint16_t reserved;
+};
+
+/*
+ *
+ * Chrome trace export
+ *
+ */
+inline void write_json_string(FILE *out, const char *str) {
+  fputc('"', out);
+  for (; *str != '\0'; ++str) {
+    if (*str == '"' || *str == '\\') {
+      fputc('\\', out);
+    }
+    fputc(*str, out);
+  }
+  fputc('"', out);
+}
+
+// Converts binary TraceRecords into chrome://tracing / Perfetto JSON. Every
+// record becomes a complete ("X") event, viewers nest them by time per tid.
+inline void write_chrome_trace(FILE *in, FILE *out) {
+  const int pid = getpid();
+  const double ticks_per_us = Clock::ticks_per_ns() * 1000.0;
+
+  TraceRecord record;
+  uint64_t first_tick = UINT64_MAX;
+  while (fread(&record, sizeof(record), 1, in) == 1) {
+    first_tick = std::min(first_tick, record.start);
+  }
+  rewind(in);
+
+  fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", out);
+  bool first = true;
+  while (fread(&record, sizeof(record), 1, in) == 1) {
+    const Site &site = SiteRegistry::get(record.site);
+    fputs(first ? "{\"name\":" : ",\n{\"name\":", out);
+    write_json_string(out, site.function);
+    fprintf(out,
+            ",\"cat\":\"profile\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%u,\"args\":{\"file\":",
+            double(record.start - first_tick) / ticks_per_us,
+            double(record.end - record.start) / ticks_per_us, pid,
+            record.thread);
+    write_json_string(out, site.file);
+    fprintf(out, ",\"line\":%ld,\"depth\":%u}}", site.line, record.depth);
+    first = false;
+  }
+  fputs("\n]}\n", out);
+}
+
+// Single producer (the owning thread), single consumer (the flusher)
+class TraceRing {
+public:
+  static constexpr size_t CAPACITY{size_t(1) << 16};
+  static constexpr size_t MASK{CAPACITY - 1};
+
+  explicit TraceRing(uint32_t thread) : m_thread(thread) {}
+
+  uint32_t thread() const { return m_thread; }
+
+  bool push(const TraceRecord &record) {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_cached_tail == CAPACITY) {
+      m_cached_tail = m_tail.load(std::memory_order_acquire);
+      if (head - m_cached_tail == CAPACITY) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    m_records[head & MASK] = record;
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Writes everything published so far to file, or discards it when file is
+  // null, returns the number of records
+  size_t drain(FILE *file) {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    const size_t head = m_head.load(std::memory_order_acquire);
+    const size_t count = head - tail;
+    if (count == 0) {
+      return 0;
+    }
+    if (file == nullptr) {
+      m_tail.store(head, std::memory_order_release);
+      return count;
+    }
+
+    const size_t first = tail & MASK;
+    const size_t until_wrap = CAPACITY - first;
+    if (count <= until_wrap) {
+      fwrite(&m_records[first], sizeof(TraceRecord), count, file);
+    } else {
+      fwrite(&m_records[first], sizeof(TraceRecord), until_wrap, file);
+      fwrite(&m_records[0], sizeof(TraceRecord), count - until_wrap, file);
+    }
+    m_tail.store(head, std::memory_order_release);
+    return count;
+  }
+
+  uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+  std::atomic<bool> retired{false};
+
+private:
+  alignas(64) std::atomic<size_t> m_head{0};
+  size_t m_cached_tail{0};
+  std::atomic<uint64_t> m_dropped{0};
+  alignas(64) std::atomic<size_t> m_tail{0};
+  const uint32_t m_thread;
+  alignas(64) TraceRecord m_records[CAPACITY];
+};
+
+// Where records go when no variable names a file, nullptr discards them
+#ifndef PROFILER_DEFAULT_OUTPUT
+#define PROFILER_DEFAULT_OUTPUT "profile.bin"
+#endif
+
+/*
+ * Owns every thread's ring and drains them from a background thread every
+ * FLUSH_INTERVAL and once more at exit. Records are written to
+ * PROFILER_OUTPUT if set, else to profile.bin if PROFILER_TRACE or
+ * PROFILER_CHROME_TRACE is set, else to PROFILER_DEFAULT_OUTPUT. The site
+ * table goes to the same path with a .sites suffix, headed by the Clock
+ * rate. When PROFILER_CHROME_TRACE names a file the records are also exported
+ * there as a chrome://tracing JSON at exit. If the file cannot be opened the
+ * records are discarded and counted as dropped.
+ */
+class TraceFlusher {
+public:
+  static constexpr std::chrono::milliseconds FLUSH_INTERVAL{1};
+
+  static TraceFlusher &instance() {
+    static TraceFlusher flusher;
+    return flusher;
+  }
+
+  TraceRing *attach() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_rings.push_back(std::make_unique<TraceRing>(m_next_thread++));
+    return m_rings.back().get();
+  }
+
+  void flush() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    drain();
+  }
+
+  uint64_t dropped() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    uint64_t dropped = m_retired_dropped + m_unwritten;
+    for (const auto &ring : m_rings) {
+      dropped += ring->dropped();
+    }
+    return dropped;
+  }
+
+  ~TraceFlusher() {
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_stop = true;
+    }
+    m_wakeup.notify_one();
+    m_thread.join();
+
+    drain();
+    if (m_file == nullptr) {
+      return;
+    }
+    write_sites();
+    fclose(m_file);
+
+    if (const char *chrome_path = getenv("PROFILER_CHROME_TRACE")) {
+      export_chrome_trace(chrome_path);
+    }
+  }
+
+private:
+  TraceFlusher() {
+    const char *path = getenv("PROFILER_OUTPUT");
+    if (path == nullptr) {
+      const bool traced = getenv("PROFILER_TRACE") != nullptr ||
+                          getenv("PROFILER_CHROME_TRACE") != nullptr;
+      path = traced ? "profile.bin" : PROFILER_DEFAULT_OUTPUT;
+    }
+    if (path != nullptr) {
+      m_path = path;
+      m_file = fopen(m_path.c_str(), "wb");
+      if (m_file == nullptr) {
+        fprintf(stderr, "profiler: cannot open %s, dropping records\n",
+                m_path.c_str());
+        m_failed = true;
+      }
+    }
+    m_thread = std::thread([this] { run(); });
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (!m_stop) {
+      drain();
+      m_wakeup.wait_for(lock, FLUSH_INTERVAL);
+    }
+  }
+
+  // Called with m_lock held
+  void drain() {
+    for (auto it = m_rings.begin(); it != m_rings.end();) {
+      TraceRing &ring = **it;
+      const bool retired = ring.retired.load(std::memory_order_acquire);
+      const size_t count = ring.drain(m_file);
+      if (m_failed) {
+        m_unwritten += count;
+      }
+      if (retired) {
+        m_retired_dropped += ring.dropped();
+        it = m_rings.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void write_sites() {
+    FILE *sites = fopen((m_path + ".sites").c_str(), "w");
+    if (sites == nullptr) {
+      return;
+    }
+    fprintf(sites, "# ticks_per_ns\t%.6f\n", Clock::ticks_per_ns());
+    for (uint32_t id = 0, l = SiteRegistry::count(); id < l; ++id) {
+      const Site &site = SiteRegistry::get(id);
+      fprintf(sites, "%u\t%s\t%s\t%ld\n", id, site.function, site.file,
+              site.line);
+    }
+    fclose(sites);
+  }
+
+  void export_chrome_trace(const char *chrome_path) {
+    FILE *in = fopen(m_path.c_str(), "rb");
+    FILE *out = fopen(chrome_path, "w");
+    if (in != nullptr && out != nullptr) {
+      write_chrome_trace(in, out);
+    }
+    if (in != nullptr) {
+      fclose(in);
+    }
+    if (out != nullptr) {
+      fclose(out);
+    }
+  }
+
+  std::mutex m_lock;
+  std::condition_variable m_wakeup;
+  std::vector<std::unique_ptr<TraceRing>> m_rings;
+  std::thread m_thread;
+  std::string m_path;
+  FILE *m_file{nullptr};
+  uint32_t m_next_thread{0};
+  uint64_t m_retired_dropped{0};
+  uint64_t m_unwritten{0};
+  bool m_failed{false};
+  bool m_stop{false};
+};
+
+struct RingBufferSink {
+  static void record(uint16_t site_id, uint32_t depth, uint64_t start,
+                     uint64_t end) {
+    TraceRing *ring = t_ring;
+    if (ring == nullptr) {
+      ring = attach();
+      if (ring == nullptr) {
+        return;
+      }
+    }
+    ring->push(
+        {start, end, site_id, uint16_t(ring->thread()), uint16_t(depth), 0});
+  }
+
+private:
+  // Marks the ring retired when its thread exits, the flusher frees it.
+  // Scopes closed by later thread_local destructors are not recorded.
+  struct RingOwner {
+    TraceRing *ring;
+    ~RingOwner() {
+      ring->retired.store(true, std::memory_order_release);
+      t_ring = nullptr;
+      t_exited = true;
+    }
+  };
+
+  __attribute__((noinline)) static TraceRing *attach() {
+    if (t_exited) {
+      return nullptr;
+    }
+    static thread_local RingOwner owner{TraceFlusher::instance().attach()};
+    t_ring = owner.ring;
+    return t_ring;
+  }
+
+  static inline thread_local TraceRing *t_ring = nullptr;
+  static inline thread_local bool t_exited = false;
+};
+
+/*
+ *
+ * Aggregating sink, per site count/sum/min/max and a log2 histogram
+ *
+ */
+struct SiteSummary {
+  static constexpr size_t BUCKETS{64};
+
+  uint64_t count{0};
+  uint64_t sum{0};
+  uint64_t min{UINT64_MAX};
+  uint64_t max{0};
+  uint64_t buckets[BUCKETS]{}; // bucket i holds durations in [2^(i-1), 2^i)
+
+  // Upper bound of the bucket holding the given quantile, in ticks
+  uint64_t percentile(double quantile) const {
+    const uint64_t rank = uint64_t(quantile * double(count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      seen += buckets[i];
+      if (seen > rank) {
+        return std::min(max, i == 0 ? uint64_t(0) : (uint64_t(1) << i) - 1);
+      }
+    }
+    return max;
+  }
+
+  void merge(const SiteSummary &other) {
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      buckets[i] += other.buckets[i];
+    }
+  }
+};
+
+// Site tables are written only by their owning thread and read concurrently
+// by aggregators. A single writer means relaxed load/store, no
+// read-modify-write.
+inline void relaxed_add(std::atomic<uint64_t> &value, uint64_t by) {
+  value.store(value.load(std::memory_order_relaxed) + by,
+              std::memory_order_relaxed);
+}
+
+struct SiteStats {
+  using Summary = SiteSummary;
+
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> min{UINT64_MAX};
+  std::atomic<uint64_t> max{0};
+  std::atomic<uint64_t> buckets[SiteSummary::BUCKETS]{};
+
+  void add(uint64_t ticks) {
+    const size_t bucket = ticks == 0 ? 0 : 64 - __builtin_clzll(ticks);
+    relaxed_add(count, 1);
+    relaxed_add(sum, ticks);
+    relaxed_add(buckets[std::min(bucket, SiteSummary::BUCKETS - 1)], 1);
+    if (ticks < min.load(std::memory_order_relaxed)) {
+      min.store(ticks, std::memory_order_relaxed);
+    }
+    if (ticks > max.load(std::memory_order_relaxed)) {
+      max.store(ticks, std::memory_order_relaxed);
+    }
+  }
+
+  void snapshot(SiteSummary &summary) const {
+    SiteSummary own;
+    own.count = count.load(std::memory_order_relaxed);
+    own.sum = sum.load(std::memory_order_relaxed);
+    own.min = min.load(std::memory_order_relaxed);
+    own.max = max.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < SiteSummary::BUCKETS; ++i) {
+      own.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+    }
+    summary.merge(own);
+  }
+};
+
+// One thread's Stats per site, allocated on the site's first hit
+template <typename Stats> class SiteTable {
+public:
+  ~SiteTable() {
+    for (auto &site : m_sites) {
+      delete site.load(std::memory_order_relaxed);
+    }
+  }
+
+  Stats &get(uint32_t site_id) {
+    Stats *stats = m_sites[site_id].load(std::memory_order_relaxed);
+    if (stats == nullptr) {
+      stats = new Stats;
+      m_sites[site_id].store(stats, std::memory_order_release);
+    }
+    return *stats;
+  }
+
+  void snapshot(std::vector<typename Stats::Summary> &summaries) const {
+    for (size_t id = 0; id < summaries.size(); ++id) {
+      if (const Stats *stats = m_sites[id].load(std::memory_order_acquire)) {
+        stats->snapshot(summaries[id]);
+      }
+    }
+  }
+
+private:
+  std::atomic<Stats *> m_sites[MAX_SITES]{};
+};
+
+// Every thread's SiteTable<Stats>. Tables of exited threads are folded into
+// a retired summary so their data outlives the thread.
+template <typename Stats> class SiteTables {
+public:
+  using Summary = typename Stats::Summary;
+
+  static SiteTables &instance() {
+    static SiteTables tables;
+    return tables;
+  }
+
+  // Table of the calling thread, null once its thread_locals are destroyed
+  static SiteTable<Stats> *local() {
+    SiteTable<Stats> *table = t_table;
+    if (table == nullptr) {
+      table = attach_thread();
+    }
+    return table;
+  }
+
+  std::vector<Summary> summaries() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    std::vector<Summary> summaries(m_retired);
+    summaries.resize(SiteRegistry::count());
+    for (const auto *table : m_tables) {
+      table->snapshot(summaries);
+    }
+    return summaries;
+  }
+
+private:
+  struct TableOwner {
+    SiteTable<Stats> *table;
+    ~TableOwner() {
+      instance().detach(table);
+      t_table = nullptr;
+      t_exited = true;
+    }
+  };
+
+  __attribute__((noinline)) static SiteTable<Stats> *attach_thread() {
+    if (t_exited) {
+      return nullptr;
+    }
+    static thread_local TableOwner owner{instance().attach()};
+    t_table = owner.table;
+    return t_table;
+  }
+
+  SiteTable<Stats> *attach() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_tables.push_back(new SiteTable<Stats>);
+    return m_tables.back();
+  }
+
+  void detach(SiteTable<Stats> *table) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_retired.resize(SiteRegistry::count());
+    table->snapshot(m_retired);
+    m_tables.erase(std::find(m_tables.begin(), m_tables.end(), table));
+    delete table;
+  }
+
+  static inline thread_local SiteTable<Stats> *t_table = nullptr;
+  static inline thread_local bool t_exited = false;
+
+  std::mutex m_lock;
+  std::vector<SiteTable<Stats> *> m_tables;
+  std::vector<Summary> m_retired;
+};
+
+/*
+ * Summaries of the aggregating sink, built on demand with dump()/summary(),
+ * or every interval by report_every(), which also dumps once more at exit.
+ */
+class StatsAggregator {
+public:
+  static StatsAggregator &instance() {
+    static StatsAggregator aggregator;
+    return aggregator;
+  }
+
+  std::vector<SiteSummary> summaries() {
+    return SiteTables<SiteStats>::instance().summaries();
+  }
+
+  SiteSummary summary(uint32_t site_id) {
+    const auto all = summaries();
+    return site_id < all.size() ? all[site_id] : SiteSummary{};
+  }
+
+  void dump(FILE *out) {
+    const auto all = summaries();
+    for (uint32_t id = 0; id < all.size(); ++id) {
+      const SiteSummary &summary = all[id];
+      if (summary.count == 0) {
+        continue;
+      }
+      const Site &site = SiteRegistry::get(id);
+      fprintf(out,
+              "{ \"file\" : \"%s\", \"line\" : %ld, \"function\" : \"%s\", "
+              "\"count\" : %lu, \"mean\" : %.3f, \"min\" : %.3f, "
+              "\"max\" : %.3f, \"p50\" : %.3f, \"p90\" : %.3f, "
+              "\"p99\" : %.3f  }\n",
+              site.file, site.line, site.function, summary.count,
+              Clock::to_ns(summary.sum) / double(summary.count),
+              Clock::to_ns(summary.min), Clock::to_ns(summary.max),
+              Clock::to_ns(summary.percentile(0.5)),
+              Clock::to_ns(summary.percentile(0.9)),
+              Clock::to_ns(summary.percentile(0.99)));
+    }
+    fflush(out);
+  }
+
+  void report_every(std::chrono::milliseconds interval, FILE *out) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_reporter.joinable()) {
+      return;
+    }
+    m_reporter = std::thread([this, interval, out] {
+      std::unique_lock<std::mutex> lock(m_lock);
+      while (!m_stop) {
+        m_wakeup.wait_for(lock, interval);
+        lock.unlock();
+        dump(out);
+        lock.lock();
+      }
+    });
+  }
+
+  ~StatsAggregator() {
+    {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_stop = true;
+    }
+    m_wakeup.notify_one();
+    if (m_reporter.joinable()) {
+      m_reporter.join();
+    }
+  }
+
+private:
+  // The tables must outlive the reporter's final dump
+  StatsAggregator() { SiteTables<SiteStats>::instance(); }
+
+  std::mutex m_lock;
+  std::condition_variable m_wakeup;
+  std::thread m_reporter;
+  bool m_stop{false};
+};
+
+struct AggregateSink {
+  static void record(uint16_t site_id, uint32_t, uint64_t start,
+                     uint64_t end) {
+    if (auto *table = SiteTables<SiteStats>::local()) {
+      table->get(site_id).add(end - start);
+    }
+  }
+};
+
+/*
+ *
+ * Hardware counters
+ *
+ * Same perf_event_open approach as benchmark/src/perf_counters.h: one event
+ * group per thread, all values read by a single read() in the
+ * PERF_FORMAT_GROUP layout. Generic kernel events are used so libpfm is not
+ * needed. PROFILER_PERF_EVENTS selects the group, for example
+ * "cycles,instructions,branch_misses", default is all of PERF_EVENTS.
+ *
+ */
+struct PerfEvent {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+inline constexpr PerfEvent PERF_EVENTS[]{
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"l1d_misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+inline constexpr size_t MAX_COUNTERS{sizeof(PERF_EVENTS) / sizeof(PerfEvent)};
+
+// PERF_FORMAT_GROUP read layout, nr followed by the values
+struct PerfCounterValues {
+  uint64_t nr;
+  uint64_t values[MAX_COUNTERS];
+};
+
+class PerfCounters {
+public:
+  // Indices into PERF_EVENTS, the same for every thread
+  static const std::vector<size_t> &selection() {
+    static const std::vector<size_t> events = [] {
+      std::vector<size_t> events;
+      const char *list = getenv("PROFILER_PERF_EVENTS");
+      for (size_t i = 0; i < MAX_COUNTERS; ++i) {
+        if (list == nullptr || contains(list, PERF_EVENTS[i].name)) {
+          events.push_back(i);
+        }
+      }
+      return events;
+    }();
+    return events;
+  }
+
+  static PerfCounters &local() {
+    static thread_local PerfCounters counters;
+    return counters;
+  }
+
+  bool valid() const { return m_valid; }
+
+  size_t count() const { return m_count; }
+
+  void snapshot(PerfCounterValues &values) const {
+    if (!m_valid ||
+        ::read(m_fds[0], &values, sizeof(uint64_t) * (1 + m_count)) <= 0) {
+      values = {};
+    }
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+
+  ~PerfCounters() {
+    for (size_t i = 0; i < m_count; ++i) {
+      if (m_fds[i] >= 0) {
+        close(m_fds[i]);
+      }
+    }
+  }
+
+private:
+  PerfCounters() {
+    const auto &events = selection();
+    m_count = events.size();
+    m_fds.fill(-1);
+
+    m_valid = m_count > 0;
+    for (size_t i = 0; i < m_count && m_valid; ++i) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = PERF_EVENTS[events[i]].type;
+      attr.config = PERF_EVENTS[events[i]].config;
+      attr.disabled = 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+
+      m_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1,
+                         i == 0 ? -1 : m_fds[0], 0);
+      m_valid = m_fds[i] >= 0;
+    }
+
+    static std::once_flag warned;
+    if (!m_valid && m_count > 0) {
+      std::call_once(warned, [] {
+        fprintf(stderr, "profiler: perf_event_open failed, counters off\n");
+      });
+    }
+  }
+
+  static bool contains(const char *list, const char *name) {
+    const size_t length = strlen(name);
+    for (const char *at = strstr(list, name); at != nullptr;
+         at = strstr(at + 1, name)) {
+      const bool starts = at == list || at[-1] == ',';
+      const bool ends = at[length] == '\0' || at[length] == ',';
+      if (starts && ends) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::array<int, MAX_COUNTERS> m_fds;
+  size_t m_count{0};
+  bool m_valid{false};
+};
+
+struct CounterSummary {
+  uint64_t count{0};
+  uint64_t ticks{0};
+  uint64_t values[MAX_COUNTERS]{};
+
+  void merge(const CounterSummary &other) {
+    count += other.count;
+    ticks += other.ticks;
+    for (size_t i = 0; i < MAX_COUNTERS; ++i) {
+      values[i] += other.values[i];
+    }
+  }
+};
+
+struct CounterStats {
+  using Summary = CounterSummary;
+
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> ticks{0};
+  std::atomic<uint64_t> values[MAX_COUNTERS]{};
+
+  void add(uint64_t duration, const PerfCounterValues &begin,
+           const PerfCounterValues &end, size_t counters) {
+    relaxed_add(count, 1);
+    relaxed_add(ticks, duration);
+    for (size_t i = 0; i < counters; ++i) {
+      relaxed_add(values[i], end.values[i] - begin.values[i]);
+    }
+  }
+
+  void snapshot(CounterSummary &summary) const {
+    CounterSummary own;
+    own.count = count.load(std::memory_order_relaxed);
+    own.ticks = ticks.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < MAX_COUNTERS; ++i) {
+      own.values[i] = values[i].load(std::memory_order_relaxed);
+    }
+    summary.merge(own);
+  }
+};
+
+// Per site counter totals, dumped on demand and once at exit to stderr
+class CounterAggregator {
+public:
+  static CounterAggregator &instance() {
+    static CounterAggregator aggregator;
+    return aggregator;
+  }
+
+  std::vector<CounterSummary> summaries() {
+    return SiteTables<CounterStats>::instance().summaries();
+  }
+
+  void dump(FILE *out) {
+    const auto &events = PerfCounters::selection();
+    size_t cycles = MAX_COUNTERS;
+    size_t instructions = MAX_COUNTERS;
+    for (size_t i = 0; i < events.size(); ++i) {
+      if (events[i] == 0) {
+        cycles = i;
+      } else if (events[i] == 1) {
+        instructions = i;
+      }
+    }
+
+    const auto all = summaries();
+    for (uint32_t id = 0; id < all.size(); ++id) {
+      const CounterSummary &summary = all[id];
+      if (summary.count == 0) {
+        continue;
+      }
+      const Site &site = SiteRegistry::get(id);
+      const double calls = double(summary.count);
+      fprintf(out,
+              "{ \"file\" : \"%s\", \"line\" : %ld, \"function\" : \"%s\", "
+              "\"count\" : %lu, \"mean\" : %.3f",
+              site.file, site.line, site.function, summary.count,
+              Clock::to_ns(summary.ticks) / calls);
+      if (cycles != MAX_COUNTERS && instructions != MAX_COUNTERS) {
+        const double ipc = summary.values[cycles]
+                               ? double(summary.values[instructions]) /
+                                     double(summary.values[cycles])
+                               : 0.0;
+        fprintf(out, ", \"ipc\" : %.3f", ipc);
+      }
+      for (size_t i = 0; i < events.size(); ++i) {
+        fprintf(out, ", \"%s_per_call\" : %.3f", PERF_EVENTS[events[i]].name,
+                double(summary.values[i]) / calls);
+      }
+      fprintf(out, "  }\n");
+    }
+    fflush(out);
+  }
+
+  ~CounterAggregator() { dump(stderr); }
+
+private:
+  CounterAggregator() { SiteTables<CounterStats>::instance(); }
+};
+
+/*
+ *
+ * Profiler implementation
+ *
+ */
+inline thread_local uint32_t t_scope_depth = 0;
+
+// Scopes skipped by sampling or a disabled site read no clock at all
+template <typename Sink> class ScopeProfiler {
+public:
+  explicit ScopeProfiler(SiteSlot &slot)
+      : m_site(slot.id()), m_active(slot.sampled(m_site)) {
+    if (m_active) {
+      m_depth = t_scope_depth++;
+      m_start = Clock::now();
+    }
+  }
+  ~ScopeProfiler() {
+    if (m_active) {
+      const uint64_t end = Clock::now_end();
+      --t_scope_depth;
+      Sink::record(m_site, m_depth, m_start, end);
+    }
+  }
+
+private:
+  const uint16_t m_site;
+  const bool m_active;
+  uint32_t m_depth;
+  uint64_t m_start;
+};
+
+// Reads the counter group outside the timed region on both ends, so the
+// read() syscalls do not show up in the scope duration
+template <typename Sink> class CounterScopeProfiler {
+public:
+  explicit CounterScopeProfiler(SiteSlot &slot)
+      : m_site(slot.id()), m_active(slot.sampled(m_site)) {
+    if (m_active) {
+      static CounterAggregator &report = CounterAggregator::instance();
+      (void)report;
+      m_depth = t_scope_depth++;
+      PerfCounters::local().snapshot(m_begin);
+      m_start = Clock::now();
+    }
+  }
+  ~CounterScopeProfiler() {
+    if (m_active) {
+      const uint64_t end = Clock::now_end();
+      const PerfCounters &counters = PerfCounters::local();
+      PerfCounterValues values;
+      counters.snapshot(values);
+      --t_scope_depth;
+
+      if (auto *table = SiteTables<CounterStats>::local()) {
+        table->get(m_site).add(end - m_start, m_begin, values,
+                               counters.count());
+      }
+      Sink::record(m_site, m_depth, m_start, end);
+    }
+  }
+
+private:
+  const uint16_t m_site;
+  const bool m_active;
+  uint32_t m_depth;
+  uint64_t m_start;
+  PerfCounterValues m_begin;
+};
+
+} // namespace profiler
+
+#ifndef PROFILER_SINK
+#define PROFILER_SINK profiler::RingBufferSink
+#endif
+
+/*
+ *
+ * Utility macros
+ *
+ * PROFILE_COUNTERS*() also captures the hardware counter group, defining
+ * PROFILER_COUNTERS makes PROFILE() do the same. PROFILE_EVERY_N(n) and
+ * PROFILE_EVERY_MS(ms) start their site sampled, SiteSlot::set_sampling()
+ * and set_enabled() change any site at runtime.
+ *
+ */
+#define __PERF_INIT(x, y, scope, calls, ns)                                    \
+  static profiler::SiteSlot x##y##_site{__FUNCTION__, __FILE__, __LINE__,      \
+                                        calls, ns};                            \
+  scope x##y(x##y##_site)
+#define __PERF_APPEND(x, y, scope, calls, ns) __PERF_INIT(x, y, scope, calls, ns)
+#define PROFILE_SAMPLED_WITH(sink, calls, ns)                                  \
+  __PERF_APPEND(__perf_, __COUNTER__, profiler::ScopeProfiler<sink>, calls, ns)
+#define PROFILE_WITH(sink) PROFILE_SAMPLED_WITH(sink, 1, 0)
+#define PROFILE_COUNTERS_WITH(sink)                                            \
+  __PERF_APPEND(__perf_, __COUNTER__, profiler::CounterScopeProfiler<sink>, 1, \
+                0)
+#define PROFILE_COUNTERS() PROFILE_COUNTERS_WITH(PROFILER_SINK)
+#define PROFILE_EVERY_N(n) PROFILE_SAMPLED_WITH(PROFILER_SINK, n, 0)
+#define PROFILE_EVERY_MS(ms)                                                   \
+  PROFILE_SAMPLED_WITH(PROFILER_SINK, 1, uint64_t(ms) * 1000000)
+
+#ifdef PROFILER_COUNTERS
+#define PROFILE() PROFILE_COUNTERS()
+#else
+#define PROFILE() PROFILE_WITH(PROFILER_SINK)
+#endif
+
+#endif // PROFILER_H
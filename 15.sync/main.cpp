@@ -2,7 +2,12 @@
 
 #include <algorithm>
 #include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <immintrin.h>
+#include <linux/futex.h>
 #include <mutex>
 #include <numeric>
 #include <random>
@@ -10,10 +15,214 @@
 #include <thread>
 #include <vector>
 
-static void bench_mutex(benchmark::State &state) {
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Spin loop pacing: pauses that double on every call, then yields once the
+// budget is spent so spinners don't starve a preempted lock holder
+struct backoff {
+  static constexpr int max_pauses = 1024;
+  int pauses = 1;
+
+  void operator()() {
+    if (pauses > max_pauses) {
+      std::this_thread::yield();
+      return;
+    }
+    for (int i = 0; i < pauses; ++i) {
+      _mm_pause();
+    }
+    pauses *= 2;
+  }
+};
+
+// Test-and-test-and-set, waiters spin on a plain load and only retry the
+// exchange once the lock looks free
+class ttas_lock {
+public:
+  void lock() {
+    backoff wait;
+    while (locked.exchange(true, std::memory_order_acquire)) {
+      while (locked.load(std::memory_order_relaxed)) {
+        wait();
+      }
+    }
+  }
+
+  bool try_lock() {
+    return !locked.load(std::memory_order_relaxed) &&
+           !locked.exchange(true, std::memory_order_acquire);
+  }
+
+  void unlock() { locked.store(false, std::memory_order_release); }
+
+private:
+  std::atomic_bool locked{false};
+};
+
+// FIFO: every thread draws a ticket and waits for it to be served
+class ticket_lock {
+public:
+  void lock() {
+    const uint32_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+    backoff wait;
+    while (serving.load(std::memory_order_acquire) != ticket) {
+      wait();
+    }
+  }
+
+  // Only draws a ticket when it would be served right away
+  bool try_lock() {
+    uint32_t ticket = serving.load(std::memory_order_acquire);
+    return next.compare_exchange_strong(ticket, ticket + 1,
+                                        std::memory_order_acquire,
+                                        std::memory_order_relaxed);
+  }
+
+  void unlock() {
+    serving.store(serving.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+  }
+
+private:
+  alignas(64) std::atomic_uint32_t next{0};
+  alignas(64) std::atomic_uint32_t serving{0};
+};
+
+// Queue lock, every waiter spins on its own node so a release touches only
+// the next waiter's cache line. Each thread has a few nodes, one per mcs_lock
+// it holds at the same time
+class mcs_lock {
+public:
+  void lock() {
+    Node &node = acquire_node();
+    Node *prev = tail.exchange(&node, std::memory_order_acq_rel);
+    if (prev) {
+      prev->next.store(&node, std::memory_order_release);
+      backoff wait;
+      while (node.locked.load(std::memory_order_acquire)) {
+        wait();
+      }
+    }
+  }
+
+  bool try_lock() {
+    Node &node = acquire_node();
+    Node *expected = nullptr;
+    if (tail.compare_exchange_strong(expected, &node,
+                                     std::memory_order_acquire,
+                                     std::memory_order_relaxed)) {
+      return true;
+    }
+    node.owner = nullptr;
+    return false;
+  }
+
+  void unlock() {
+    Node &node = held_node();
+    Node *next = node.next.load(std::memory_order_acquire);
+    if (!next) {
+      Node *expected = &node;
+      if (tail.compare_exchange_strong(expected, nullptr,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+        node.owner = nullptr;
+        return;
+      }
+      // A waiter swapped itself in but hasn't linked to us yet
+      backoff wait;
+      while (!(next = node.next.load(std::memory_order_acquire))) {
+        wait();
+      }
+    }
+    next->locked.store(false, std::memory_order_release);
+    node.owner = nullptr;
+  }
+
+private:
+  static constexpr int max_held = 8;
+
+  struct alignas(64) Node {
+    std::atomic<Node *> next;
+    std::atomic_bool locked;
+    const mcs_lock *owner; // only touched by the thread owning the node
+  };
+
+  Node &acquire_node() {
+    for (Node &node : nodes) {
+      if (node.owner == nullptr) {
+        node.owner = this;
+        node.next.store(nullptr, std::memory_order_relaxed);
+        node.locked.store(true, std::memory_order_relaxed);
+        return node;
+      }
+    }
+    fprintf(stderr, "mcs_lock: more than %d held by one thread\n", max_held);
+    abort();
+  }
+
+  Node &held_node() {
+    for (Node &node : nodes) {
+      if (node.owner == this) {
+        return node;
+      }
+    }
+    fprintf(stderr, "mcs_lock: unlock without lock\n");
+    abort();
+  }
+
+  static thread_local Node nodes[max_held];
+  std::atomic<Node *> tail{nullptr};
+};
+
+thread_local mcs_lock::Node mcs_lock::nodes[mcs_lock::max_held];
+
+// Spins for a while, then sleeps in the kernel. State is 0 unlocked,
+// 1 locked, 2 locked with sleepers, as in Drepper's "Futexes Are Tricky"
+class futex_mutex {
+public:
+  void lock() {
+    for (int i = 0; i < spins; ++i) {
+      if (try_lock()) {
+        return;
+      }
+      _mm_pause();
+    }
+    int c = state.exchange(2, std::memory_order_acquire);
+    while (c != 0) {
+      futex(FUTEX_WAIT_PRIVATE, 2);
+      c = state.exchange(2, std::memory_order_acquire);
+    }
+  }
+
+  bool try_lock() {
+    int c = 0;
+    return state.load(std::memory_order_relaxed) == 0 &&
+           state.compare_exchange_strong(c, 1, std::memory_order_acquire,
+                                         std::memory_order_relaxed);
+  }
+
+  void unlock() {
+    if (state.exchange(0, std::memory_order_release) == 2) {
+      futex(FUTEX_WAKE_PRIVATE, 1);
+    }
+  }
+
+private:
+  static constexpr int spins = 100;
+
+  void futex(int op, int val) {
+    syscall(SYS_futex, reinterpret_cast<int *>(&state), op, val, nullptr,
+            nullptr, 0);
+  }
+
+  std::atomic_int state{0};
+};
+
+template <typename Mutex> static void bench_mutex(benchmark::State &state) {
 
   static std::vector<int> data;
-  static std::mutex mutex;
+  static Mutex mutex;
   static struct Data {
     int min;
     int max;
@@ -47,6 +256,8 @@ static void bench_mutex(benchmark::State &state) {
     benchmark::DoNotOptimize(*store);
   }
 
+  state.SetItemsProcessed(state.iterations() * data.size());
+
   if (state.thread_index() == 0) {
     benchmark::DoNotOptimize(*store);
     delete store;
@@ -91,6 +302,8 @@ static void bench_atomic(benchmark::State &state) {
     benchmark::DoNotOptimize(*store);
   }
 
+  state.SetItemsProcessed(state.iterations() * data.size());
+
   if (state.thread_index() == 0) {
     benchmark::DoNotOptimize(*store);
     delete store;
@@ -134,6 +347,8 @@ static void bench_no_sync(benchmark::State &state) {
     benchmark::DoNotOptimize(store.data());
   }
 
+  state.SetItemsProcessed(state.iterations() * data.size());
+
   if (state.thread_index() == 0) {
 
     Data result = std::accumulate(store.begin(), store.end(), Data{0, 0, 0},
@@ -184,6 +399,8 @@ static void bench_no_sync_with_align(benchmark::State &state) {
     benchmark::DoNotOptimize(store.data());
   }
 
+  state.SetItemsProcessed(state.iterations() * data.size());
+
   if (state.thread_index() == 0) {
 
     Data result = std::accumulate(store.begin(), store.end(), Data{0, 0, 0},
@@ -197,26 +414,164 @@ static void bench_no_sync_with_align(benchmark::State &state) {
   }
 }
 
+// Folds [first, last) into min and max, 16 values per step in two pairs of
+// AVX2 accumulators
+static void reduce_min_max(const int *first, const int *last, int &min,
+                           int &max) {
+#ifdef __AVX2__
+  __m256i min0 = _mm256_set1_epi32(min), min1 = min0;
+  __m256i max0 = _mm256_set1_epi32(max), max1 = max0;
+  for (; last - first >= 16; first += 16) {
+    const __m256i v0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+    const __m256i v1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first + 8));
+    min0 = _mm256_min_epi32(min0, v0);
+    min1 = _mm256_min_epi32(min1, v1);
+    max0 = _mm256_max_epi32(max0, v0);
+    max1 = _mm256_max_epi32(max1, v1);
+  }
+  min0 = _mm256_min_epi32(min0, min1);
+  max0 = _mm256_max_epi32(max0, max1);
+  __m128i lo = _mm_min_epi32(_mm256_castsi256_si128(min0),
+                             _mm256_extracti128_si256(min0, 1));
+  __m128i hi = _mm_max_epi32(_mm256_castsi256_si128(max0),
+                             _mm256_extracti128_si256(max0, 1));
+  lo = _mm_min_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+  hi = _mm_max_epi32(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+  lo = _mm_min_epi32(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+  hi = _mm_max_epi32(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+  min = _mm_cvtsi128_si32(lo);
+  max = _mm_cvtsi128_si32(hi);
+#endif
+  for (; first != last; ++first) {
+    min = std::min(min, *first);
+    max = std::max(max, *first);
+  }
+}
+
+// Each thread reduces its own slice of data into its own cache line, the
+// partial results are combined once after the run
+static void bench_reduce(benchmark::State &state) {
+
+  static std::vector<int> data;
+
+  // 64 bit count, every iteration adds the whole slice
+  struct alignas(64) Data {
+    int min;
+    int max;
+    int64_t count;
+  };
+  static std::vector<Data> store;
+
+  if (state.thread_index() == 0) {
+    const int count = state.range(0);
+    std::random_device r;
+    std::default_random_engine re(r());
+    std::uniform_int_distribution<int> gen(INT32_MIN, INT32_MAX);
+    data.resize(count);
+    for (auto &val : data) {
+      val = gen(re);
+    }
+    store.assign(state.threads(), Data{INT_MAX, INT_MIN, 0});
+  }
+
+  for (auto _ : state) {
+    const size_t size = data.size();
+    const int *first =
+        data.data() + size * state.thread_index() / state.threads();
+    const int *last =
+        data.data() + size * (state.thread_index() + 1) / state.threads();
+
+    auto &s = store[state.thread_index()];
+    reduce_min_max(first, last, s.min, s.max);
+    s.count += last - first;
+    benchmark::DoNotOptimize(s);
+  }
+
+  // Threads only scan their own slice, the variants above scan everything on
+  // every thread and count all of it
+  state.SetItemsProcessed(state.iterations() * data.size() / state.threads());
+
+  if (state.thread_index() == 0) {
+
+    Data result =
+        std::accumulate(store.begin(), store.end(), Data{INT_MAX, INT_MIN, 0},
+                        [](const Data &res, const Data &val) {
+                          return Data{std::min(res.min, val.min),
+                                      std::max(res.max, val.max),
+                                      res.count + val.count};
+                        });
+
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+// Every thread bumps its own counter, the counters sit `stride` bytes apart in
+// one buffer. The sweep shows where the counters stop sharing a cache line
+// (64 B) and where they stop sharing the line pair the adjacent-line
+// prefetcher pulls in together (128 B).
+//
+// Each run is one cell of the stride x threads matrix: the row is the
+// stride:S part of its name, the column the threads:T part and the value its
+// per_thread counter, updates per second of one thread. To get the matrix run
+//   ./15.sync --benchmark_filter=false_sharing --benchmark_format=json
+// and pivot "per_thread" over the stride:S in "name" and the "threads" field
+static void bench_false_sharing(benchmark::State &state) {
+
+  static constexpr int max_stride = 256;
+  static constexpr int max_threads = 64;
+  static constexpr int updates = 10000;
+
+  alignas(max_stride) static std::atomic_int32_t
+      store[max_stride * max_threads / sizeof(std::atomic_int32_t)];
+
+  const int stride = state.range(0);
+  auto &counter =
+      store[state.thread_index() * stride / sizeof(std::atomic_int32_t)];
+  counter.store(0, std::memory_order_relaxed);
+
+  for (auto _ : state) {
+    for (int i = 0; i < updates; ++i) {
+      // plain load and store, no locked instruction, so the only cost left is
+      // the cache line moving between cores
+      counter.store(counter.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    }
+  }
+
+  // Real time, so the rate is per wall clock second and kAvgThreads splits
+  // the total between the threads
+  state.SetItemsProcessed(state.iterations() * updates);
+  state.counters["per_thread"] = benchmark::Counter(
+      state.iterations() * updates,
+      benchmark::Counter::kIsRate | benchmark::Counter::kAvgThreads);
+}
+
+// Real time, so items_per_second is the throughput of all threads together
+#define BENCH_ARGS(N)                                                          \
+  Arg(100)->Arg(1000)->Arg(10000)->Arg(100000)->Threads(N)->UseRealTime()
+
+#define BENCH_LOCK(Mutex, N)                                                   \
+  BENCHMARK_TEMPLATE(bench_mutex, Mutex)->BENCH_ARGS(N)
+
 #define BENCH(N)                                                               \
-  BENCHMARK(bench_mutex)->Arg(100)->Threads(N);                                \
-  BENCHMARK(bench_mutex)->Arg(1000)->Threads(N);                               \
-  BENCHMARK(bench_mutex)->Arg(10000)->Threads(N);                              \
-  BENCHMARK(bench_mutex)->Arg(100000)->Threads(N);                             \
-                                                                               \
-  BENCHMARK(bench_atomic)->Arg(100)->Threads(N);                               \
-  BENCHMARK(bench_atomic)->Arg(1000)->Threads(N);                              \
-  BENCHMARK(bench_atomic)->Arg(10000)->Threads(N);                             \
-  BENCHMARK(bench_atomic)->Arg(100000)->Threads(N);                            \
-                                                                               \
-  BENCHMARK(bench_no_sync)->Arg(100)->Threads(N);                              \
-  BENCHMARK(bench_no_sync)->Arg(1000)->Threads(N);                             \
-  BENCHMARK(bench_no_sync)->Arg(10000)->Threads(N);                            \
-  BENCHMARK(bench_no_sync)->Arg(100000)->Threads(N);                           \
+  BENCH_LOCK(std::mutex, N);                                                   \
+  BENCH_LOCK(ttas_lock, N);                                                    \
+  BENCH_LOCK(ticket_lock, N);                                                  \
+  BENCH_LOCK(mcs_lock, N);                                                     \
+  BENCH_LOCK(futex_mutex, N);                                                  \
+  BENCHMARK(bench_atomic)->BENCH_ARGS(N);                                      \
+  BENCHMARK(bench_no_sync)->BENCH_ARGS(N);                                     \
+  BENCHMARK(bench_no_sync_with_align)->BENCH_ARGS(N);                          \
+  BENCHMARK(bench_reduce)->BENCH_ARGS(N);                                      \
                                                                                \
-  BENCHMARK(bench_no_sync_with_align)->Arg(100)->Threads(N);                   \
-  BENCHMARK(bench_no_sync_with_align)->Arg(1000)->Threads(N);                  \
-  BENCHMARK(bench_no_sync_with_align)->Arg(10000)->Threads(N);                 \
-  BENCHMARK(bench_no_sync_with_align)->Arg(100000)->Threads(N)
+  BENCHMARK(bench_false_sharing)                                               \
+      ->ArgName("stride")                                                      \
+      ->RangeMultiplier(2)                                                     \
+      ->Range(4, 256)                                                          \
+      ->Threads(N)                                                             \
+      ->UseRealTime()
 
 BENCH(1);
 BENCH(2);
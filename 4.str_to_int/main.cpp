@@ -2,28 +2,42 @@
 #include <charconv>
 #include <cstdlib>
 #include <cstring>
+#include <immintrin.h>
+#include <limits>
+#include <map>
+#include <numeric>
 #include <random>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 
+// 1000 random integers of up to the given number of digits, about half of
+// them negative
+static std::vector<std::pair<std::string, int>>
+random_integers(int digits, std::mt19937 &gen) {
+  std::uniform_int_distribution<> dis{0, 9};
+
+  std::vector<std::pair<std::string, int>> values;
+  values.reserve(1000);
+  for (int n = 0; n < 1000; ++n) {
+    int res = 0;
+    for (int i = 0; i < digits; i++) {
+      res = res * 10 + dis(gen);
+    }
+    if (dis(gen) >= 5) {
+      res *= -1;
+    }
+    values.emplace_back(std::to_string(res), res);
+  }
+  return values;
+}
+
 class string_data_fixture : public ::benchmark::Fixture {
 public:
   void SetUp(const ::benchmark::State &st) {
-    int digits = st.range(0);
     std::random_device rd;
     std::mt19937 gen{rd()};
-    std::uniform_int_distribution<> dis{0, 9};
-
-    values.reserve(1000);
-    for (int n = 0; n < 1000; ++n) {
-      int res = 0;
-      for (int i = 0; i < digits; i++) {
-        res = res * 10 + dis(gen);
-      }
-      if (dis(gen) >= 5) {
-        res *= -1;
-      }
-      values.emplace_back(std::to_string(res), res);
-    }
+    values = random_integers(st.range(0), gen);
   }
 
   void TearDown(const ::benchmark::State &) { values.clear(); }
@@ -357,4 +371,1364 @@ BENCHMARK_DEFINE_F(string_data_fixture, my_atoi3)(benchmark::State &state) {
 
 BENCH(my_atoi2);
 
+/*
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+ */
+
+/**
+ * SIMD atoi. The digits are right aligned in a 16 byte lane with a length
+ * indexed shuffle, then combined pairwise with multiply-add:
+ * 16 x 1 digit -> 8 x 2 -> 4 x 4 -> 2 x 8 digits.
+ * Reads 16 bytes from the first digit, copies to a local buffer when that
+ * would cross a page. Returns 0 on invalid input or int32_t overflow.
+ **/
+struct simd_shuffle_table {
+  constexpr simd_shuffle_table() : masks{} {
+    for (int len = 0; len <= 16; len++) {
+      for (int i = 0; i < 16; i++) {
+        const int src = i - (16 - len);
+        masks[len][i] = src < 0 ? int8_t(0x80) : int8_t(src);
+      }
+    }
+  }
+
+  alignas(16) int8_t masks[17][16];
+};
+
+static constexpr simd_shuffle_table simd_shuffle{};
+
+static inline __m128i simd_load_digits(const char *begin, int len) {
+  constexpr uintptr_t page_size = 4096;
+  if ((uintptr_t(begin) & (page_size - 1)) > page_size - 16) {
+    alignas(16) char buffer[16]{};
+    memcpy(buffer, begin, len);
+    return _mm_load_si128(reinterpret_cast<const __m128i *>(buffer));
+  }
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+}
+
+// Digit values right aligned for multiply-add, or false on a non digit
+static inline bool simd_digits(__m128i chars, int len, __m128i &digits) {
+  const __m128i values = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  const __m128i nine = _mm_set1_epi8(9);
+  const uint32_t valid = _mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_max_epu8(values, nine), nine));
+  const uint32_t expected = (1u << len) - 1;
+  digits = _mm_shuffle_epi8(
+      values,
+      _mm_load_si128(reinterpret_cast<const __m128i *>(simd_shuffle.masks[len])));
+  return (valid & expected) == expected;
+}
+
+static inline int32_t simd_finish(uint64_t magnitude, bool negative) {
+  const uint64_t limit = uint64_t(INT32_MAX) + negative;
+  if (magnitude > limit)
+    return 0;
+  return negative ? int32_t(-int64_t(magnitude)) : int32_t(magnitude);
+}
+
+int32_t simd_atoi(const char *begin, const char *end) {
+  if ((begin == nullptr) | (end == nullptr))
+    return 0;
+
+  const bool negative = *begin == '-';
+  begin += negative;
+
+  const int len = end - begin;
+  if ((len <= 0) | (len > 10))
+    return 0;
+
+  __m128i digits;
+  if (!simd_digits(simd_load_digits(begin, len), len, digits))
+    return 0;
+
+  const __m128i pairs =
+      _mm_maddubs_epi16(digits, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10,
+                                              1, 10, 1, 10, 1, 10, 1));
+  const __m128i quads =
+      _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+  const __m128i octs =
+      _mm_madd_epi16(_mm_packus_epi32(quads, quads),
+                     _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+
+  const uint64_t magnitude =
+      uint64_t(uint32_t(_mm_cvtsi128_si32(octs))) * 100000000 +
+      uint32_t(_mm_extract_epi32(octs, 1));
+  return simd_finish(magnitude, negative);
+}
+
+BENCHMARK_DEFINE_F(string_data_fixture, simd_atoi)(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (const auto &[str, integer] : values) {
+      const auto val = simd_atoi(str.c_str(), str.c_str() + str.length());
+      assert(val == integer);
+      benchmark::DoNotOptimize(&val);
+    }
+  }
+}
+
+BENCH(simd_atoi);
+
+#ifdef __AVX2__
+/**
+ * Two strings per call, one per 128 bit lane, so every multiply-add
+ * instruction works on 32 digits.
+ **/
+void simd_atoi_x2(const char *begin0, const char *end0, const char *begin1,
+                  const char *end1, int32_t out[2]) {
+  const bool negative0 = *begin0 == '-';
+  const bool negative1 = *begin1 == '-';
+  begin0 += negative0;
+  begin1 += negative1;
+
+  const int len0 = end0 - begin0;
+  const int len1 = end1 - begin1;
+  if ((len0 <= 0) | (len0 > 10) | (len1 <= 0) | (len1 > 10)) {
+    out[0] = simd_atoi(begin0 - negative0, end0);
+    out[1] = simd_atoi(begin1 - negative1, end1);
+    return;
+  }
+
+  __m128i digits0;
+  __m128i digits1;
+  const bool valid0 = simd_digits(simd_load_digits(begin0, len0), len0, digits0);
+  const bool valid1 = simd_digits(simd_load_digits(begin1, len1), len1, digits1);
+
+  const __m256i digits = _mm256_set_m128i(digits1, digits0);
+  const __m256i pairs = _mm256_maddubs_epi16(digits, _mm256_set1_epi16(0x010a));
+  const __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00010064));
+  const __m256i octs = _mm256_madd_epi16(_mm256_packus_epi32(quads, quads),
+                                         _mm256_set1_epi32(0x00012710));
+
+  const uint64_t magnitude0 =
+      uint64_t(uint32_t(_mm256_extract_epi32(octs, 0))) * 100000000 +
+      uint32_t(_mm256_extract_epi32(octs, 1));
+  const uint64_t magnitude1 =
+      uint64_t(uint32_t(_mm256_extract_epi32(octs, 4))) * 100000000 +
+      uint32_t(_mm256_extract_epi32(octs, 5));
+
+  out[0] = valid0 ? simd_finish(magnitude0, negative0) : 0;
+  out[1] = valid1 ? simd_finish(magnitude1, negative1) : 0;
+}
+
+BENCHMARK_DEFINE_F(string_data_fixture, simd_atoi_x2)
+(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (size_t i = 0; i + 1 < values.size(); i += 2) {
+      const auto &[str0, integer0] = values[i];
+      const auto &[str1, integer1] = values[i + 1];
+      int32_t val[2];
+      simd_atoi_x2(str0.c_str(), str0.c_str() + str0.length(), str1.c_str(),
+                   str1.c_str() + str1.length(), val);
+      assert(val[0] == integer0 && val[1] == integer1);
+      benchmark::DoNotOptimize(&val);
+    }
+  }
+}
+
+BENCH(simd_atoi_x2);
+#endif
+
+/*
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+ */
+
+/**
+ * Bulk parsing of a delimited buffer. Every byte below '-' (',', ' ', '\t',
+ * '\r', '\n') is a delimiter, so one signed compare per 32 byte block finds
+ * them all. Tokens are converted by a converter picked by digit count.
+ * Returns the number of integers written, invalid or out of int32_t range
+ * tokens produce 0.
+ *
+ * Buffers are 1 MB and 32 MB, the second is past the last level cache of
+ * the usual desktop part. Set BUFFER_1GB=1 to add a 1 GB point for parts
+ * with a larger cache, it needs up to 3 GB of memory.
+ **/
+class buffer_data_fixture : public ::benchmark::Fixture {
+public:
+  void SetUp(const ::benchmark::State &st) {
+    const Buffer &data = buffer_for(st.range(0), st.range(1));
+    buffer = data.text;
+    count = data.count;
+    checksum = data.checksum;
+    parsed.resize(count);
+  }
+
+  void TearDown(const ::benchmark::State &) {
+    parsed.clear();
+    parsed.shrink_to_fit();
+  }
+
+  // Sum of the integers, checked instead of a second copy of the output
+  int64_t sum(size_t n) const {
+    return std::accumulate(parsed.begin(), parsed.begin() + n, int64_t(0));
+  }
+
+  std::string_view buffer;
+  size_t count;
+  int64_t checksum;
+  std::vector<int32_t> parsed;
+
+private:
+  struct Buffer {
+    std::string text;
+    size_t count{0};
+    int64_t checksum{0};
+  };
+
+  // Built once per digits and size, every benchmark on it shares the buffer
+  static const Buffer &buffer_for(int digits, size_t size) {
+    static std::map<std::pair<int, size_t>, Buffer> buffers;
+    // Only one buffer past 32 MB is kept alive at a time
+    if (size > (1 << 25) && !buffers.count({digits, size})) {
+      for (auto it = buffers.begin(); it != buffers.end();)
+        it = it->first.second > (1 << 25) ? buffers.erase(it) : std::next(it);
+    }
+    auto [it, inserted] = buffers.try_emplace({digits, size});
+    Buffer &data = it->second;
+    if (!inserted) {
+      return data;
+    }
+
+    std::random_device rd;
+    std::mt19937 gen{rd()};
+    std::uniform_int_distribution<> coin{0, 1};
+
+    // Same integers as string_data_fixture, repeated to size
+    const auto pool = random_integers(digits, gen);
+    std::uniform_int_distribution<size_t> pick{0, pool.size() - 1};
+
+    data.text.reserve(size);
+    while (true) {
+      const auto &[str, integer] = pool[pick(gen)];
+      if (data.text.size() + str.size() + 1 > size)
+        break;
+      data.text.append(str);
+      data.text.push_back(coin(gen) ? ',' : '\n');
+      data.checksum += integer;
+      data.count++;
+    }
+    return data;
+  }
+};
+
+static std::vector<int64_t> buffer_sizes() {
+  std::vector<int64_t> sizes{1 << 20, 1 << 25};
+  if (std::getenv("BUFFER_1GB"))
+    sizes.push_back(1 << 30);
+  return sizes;
+}
+
+#define BENCH_BUFFER(test)                                                     \
+  BENCHMARK_REGISTER_F(buffer_data_fixture, test)                              \
+      ->ArgsProduct({{1, 4, 7, 10}, buffer_sizes()})                           \
+      ->Unit(benchmark::kMillisecond);
+
+template <int N> static inline uint32_t parse_digits(const char *str) {
+  // Only ten digits can overflow, they accumulate in 64 bits
+  using acc_t = std::conditional_t<(N < 10), uint32_t, uint64_t>;
+  acc_t res = 0;
+  uint32_t invalid = 0;
+  for (int i = 0; i < N; i++) {
+    const uint32_t c = uint8_t(str[i]) - '0';
+    invalid |= c > 9;
+    res = res * 10 + c;
+  }
+  invalid |= res > std::numeric_limits<uint32_t>::max();
+  return invalid ? 0 : uint32_t(res);
+}
+
+using parse_digits_t = uint32_t (*)(const char *);
+
+static constexpr parse_digits_t parse_digits_by_count[]{
+    [](const char *) { return uint32_t(0); },
+    parse_digits<1>,
+    parse_digits<2>,
+    parse_digits<3>,
+    parse_digits<4>,
+    parse_digits<5>,
+    parse_digits<6>,
+    parse_digits<7>,
+    parse_digits<8>,
+    parse_digits<9>,
+    parse_digits<10>};
+
+static inline int32_t parse_token(const char *begin, const char *end) {
+  const bool negative = *begin == '-';
+  begin += negative;
+  const size_t len = end - begin;
+  uint32_t res = len <= 10 ? parse_digits_by_count[len](begin) : 0;
+  // Out of int32_t range, as std::from_chars
+  if (res > uint32_t(std::numeric_limits<int32_t>::max()) + negative)
+    res = 0;
+  return int32_t(negative ? 0u - res : res);
+}
+
+size_t parse_ints(const char *begin, const char *end, int32_t *out) {
+  int32_t *const first = out;
+  const char *token = begin;
+  const char *block = begin;
+
+#ifdef __AVX2__
+  const __m256i limit = _mm256_set1_epi8('-');
+  for (; end - block >= 32; block += 32) {
+    const __m256i chars =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+    uint32_t delimiters =
+        _mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, chars));
+    while (delimiters) {
+      const char *delimiter = block + __builtin_ctz(delimiters);
+      delimiters &= delimiters - 1;
+      if (delimiter != token) {
+        *out++ = parse_token(token, delimiter);
+      }
+      token = delimiter + 1;
+    }
+  }
+#endif
+
+  for (; block < end; ++block) {
+    if (*block < '-') {
+      if (block != token) {
+        *out++ = parse_token(token, block);
+      }
+      token = block + 1;
+    }
+  }
+  if (token < end) {
+    *out++ = parse_token(token, end);
+  }
+  return out - first;
+}
+
+BENCHMARK_DEFINE_F(buffer_data_fixture, parse_ints)(benchmark::State &state) {
+
+  for (auto _ : state) {
+    const size_t count =
+        parse_ints(buffer.data(), buffer.data() + buffer.size(), parsed.data());
+    assert(count == this->count && sum(count) == checksum);
+    benchmark::DoNotOptimize(count);
+    benchmark::DoNotOptimize(parsed.data());
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+
+BENCH_BUFFER(parse_ints);
+
+// Baseline, scalar delimiter skipping with std::from_chars
+BENCHMARK_DEFINE_F(buffer_data_fixture, from_chars_buffer)
+(benchmark::State &state) {
+
+  for (auto _ : state) {
+    const char *str = buffer.data();
+    const char *const end = buffer.data() + buffer.size();
+    int32_t *out = parsed.data();
+    while (str < end) {
+      if (*str < '-') {
+        ++str;
+        continue;
+      }
+      str = std::from_chars(str, end, *out++).ptr;
+    }
+    assert(out - parsed.data() == int64_t(count) && sum(count) == checksum);
+    benchmark::DoNotOptimize(parsed.data());
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+
+BENCH_BUFFER(from_chars_buffer);
+
+/*
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+ */
+
+/**
+ * SWAR atoi. Up to 8 digits are loaded into a uint64_t, padded with '0'
+ * in front, validated with two masks and combined in 3 multiply-shift
+ * steps. Longer numbers are parsed as a leading chunk plus 8 digit chunks.
+ * Returns false on invalid input or overflow of T.
+ **/
+template <typename T> class integer_data_fixture : public ::benchmark::Fixture {
+public:
+  void SetUp(const ::benchmark::State &st) {
+    const int digits = st.range(0);
+    std::random_device rd;
+    std::mt19937 gen{rd()};
+    std::uniform_int_distribution<> dis{0, 9};
+
+    constexpr uint64_t max = std::numeric_limits<T>::max();
+
+    values.reserve(1000);
+    while (values.size() < 1000) {
+      uint64_t res = 0;
+      for (int i = 0; i < digits; i++) {
+        res = res * 10 + dis(gen);
+      }
+      if (res > max) {
+        continue;
+      }
+      T value = T(res);
+      if (std::is_signed_v<T> && dis(gen) >= 5) {
+        value = -value;
+      }
+      values.emplace_back(std::to_string(value), value);
+    }
+  }
+
+  void TearDown(const ::benchmark::State &) { values.clear(); }
+
+  std::vector<std::pair<std::string, T>> values;
+};
+
+#define BENCH_INTEGER(test, max_digits)                                        \
+  BENCHMARK_REGISTER_F(integer_data_fixture, test)->DenseRange(1, max_digits, 1);
+
+static inline uint64_t swar_load(const char *str, int len) {
+  constexpr uintptr_t page_size = 4096;
+  uint64_t chunk;
+  if ((uintptr_t(str) & (page_size - 1)) > page_size - 8) {
+    chunk = 0;
+    memcpy(&chunk, str, len);
+  } else {
+    memcpy(&chunk, str, 8);
+  }
+  // First character ends up in byte 8 - len, '0' bytes in front of it
+  const int shift = (8 - len) * 8;
+  const uint64_t padding =
+      shift == 0 ? 0 : 0x3030303030303030ull >> (64 - shift);
+  return (chunk << shift) | padding;
+}
+
+static inline bool swar_is_digits(uint64_t chunk) {
+  return ((chunk & 0xF0F0F0F0F0F0F0F0ull) |
+          (((chunk + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) ==
+         0x3333333333333333ull;
+}
+
+static inline uint32_t swar_combine(uint64_t chunk) {
+  chunk = ((chunk & 0x0F0F0F0F0F0F0F0Full) * 2561) >> 8;
+  chunk = ((chunk & 0x00FF00FF00FF00FFull) * 6553601) >> 16;
+  return uint32_t(((chunk & 0x0000FFFF0000FFFFull) * 42949672960001ull) >> 32);
+}
+
+// Magnitude of up to 20 digits, false on a non digit or uint64_t overflow
+static inline bool swar_magnitude(const char *str, int len, uint64_t &res) {
+  const int head = len - ((len - 1) / 8) * 8;
+  uint64_t chunk = swar_load(str, head);
+  bool valid = swar_is_digits(chunk);
+  res = swar_combine(chunk);
+
+  for (str += head, len -= head; len > 0; str += 8, len -= 8) {
+    chunk = swar_load(str, 8);
+    valid &= swar_is_digits(chunk);
+    if (__builtin_mul_overflow(res, uint64_t(100000000), &res) |
+        __builtin_add_overflow(res, uint64_t(swar_combine(chunk)), &res))
+      return false;
+  }
+  return valid;
+}
+
+template <typename T>
+bool swar_atoi(const char *begin, const char *end, T &value) {
+  const bool negative = std::is_signed_v<T> && *begin == '-';
+  begin += negative;
+
+  // Leading zeros don't count towards the 20 digit limit
+  while (end - begin > 1 && *begin == '0')
+    ++begin;
+
+  const int len = end - begin;
+  if ((len <= 0) | (len > 20))
+    return false;
+
+  uint64_t magnitude;
+  if (!swar_magnitude(begin, len, magnitude))
+    return false;
+
+  using U = std::make_unsigned_t<T>;
+  const uint64_t limit =
+      uint64_t(std::numeric_limits<T>::max()) + (std::is_signed_v<T> & negative);
+  if (magnitude > limit)
+    return false;
+
+  value = T(negative ? U(0) - U(magnitude) : U(magnitude));
+  return true;
+}
+
+#define SWAR_BENCH(type, max_digits)                                           \
+  BENCHMARK_TEMPLATE_DEFINE_F(integer_data_fixture, swar_##type, type)         \
+  (benchmark::State & state) {                                                 \
+    for (auto _ : state) {                                                     \
+      for (const auto &[str, integer] : values) {                              \
+        type val = 0;                                                          \
+        const bool ok =                                                        \
+            swar_atoi(str.c_str(), str.c_str() + str.length(), val);           \
+        assert(ok && val == integer);                                          \
+        benchmark::DoNotOptimize(ok);                                          \
+        benchmark::DoNotOptimize(&val);                                        \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  BENCH_INTEGER(swar_##type, max_digits)                                       \
+                                                                               \
+  BENCHMARK_TEMPLATE_DEFINE_F(integer_data_fixture, from_chars_##type, type)   \
+  (benchmark::State & state) {                                                 \
+    for (auto _ : state) {                                                     \
+      for (const auto &[str, integer] : values) {                              \
+        type val = 0;                                                          \
+        std::from_chars(str.c_str(), str.c_str() + str.length(), val);         \
+        assert(val == integer);                                                \
+        benchmark::DoNotOptimize(&val);                                        \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  BENCH_INTEGER(from_chars_##type, max_digits)
+
+SWAR_BENCH(int32_t, 10)
+SWAR_BENCH(uint32_t, 10)
+SWAR_BENCH(int64_t, 19)
+SWAR_BENCH(uint64_t, 19)
+
+/*
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+ */
+
+/**
+ * Integer to string. All converters write the digits of value to out and
+ * return one past the last character, out needs room for 11 characters.
+ * The benchmarks parse the result back with simd_atoi and swar_atoi.
+ **/
+struct digit_pairs_table {
+  constexpr digit_pairs_table() : pairs{} {
+    for (int i = 0; i < 100; i++) {
+      pairs[i * 2] = char('0' + i / 10);
+      pairs[i * 2 + 1] = char('0' + i % 10);
+    }
+  }
+
+  char pairs[200];
+};
+
+static constexpr digit_pairs_table digit_pairs{};
+
+static inline uint32_t itoa_magnitude(char *&out, int32_t value) {
+  const bool negative = value < 0;
+  *out = '-';
+  out += negative;
+  return negative ? 0u - uint32_t(value) : uint32_t(value);
+}
+
+// One or two digits of value < 100 at out, the second store overwrites the
+// first one when value < 10
+static inline char *itoa_leading_digits(char *out, uint32_t value) {
+  const char *pair = digit_pairs.pairs + value * 2;
+  out[0] = pair[value < 10];
+  out[value >= 10] = pair[1];
+  return out + 1 + (value >= 10);
+}
+
+// Two digits at a time from the end into a local buffer
+char *lut_itoa(char *out, int32_t value) {
+  uint32_t u = itoa_magnitude(out, value);
+
+  char buffer[10];
+  char *const end = buffer + sizeof(buffer);
+  char *p = end;
+  while (u >= 100) {
+    p -= 2;
+    memcpy(p, digit_pairs.pairs + (u % 100) * 2, 2);
+    u /= 100;
+  }
+  if (u >= 10) {
+    p -= 2;
+    memcpy(p, digit_pairs.pairs + u * 2, 2);
+  } else {
+    *--p = char('0' + u);
+  }
+
+  memcpy(out, p, end - p);
+  return out + (end - p);
+}
+
+BENCHMARK_DEFINE_F(string_data_fixture, lut_itoa)(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (const auto &[str, integer] : values) {
+      char buffer[16];
+      const char *end = lut_itoa(buffer, integer);
+      assert(std::string_view(buffer, end - buffer) == str);
+      assert(simd_atoi(buffer, end) == integer);
+      benchmark::DoNotOptimize(end);
+      benchmark::DoNotOptimize(buffer);
+    }
+  }
+}
+
+BENCH(lut_itoa);
+
+/**
+ * Digit count from the bit width, log10(2) ~ 1233 / 4096, corrected by one
+ * comparison. The digits are then stored straight to their final position.
+ **/
+static inline int itoa_digit_count(uint32_t value) {
+  static constexpr uint32_t powers_of_10[]{
+      0,         10,         100,         1000,      10000,
+      100000,    1000000,    10000000,    100000000, 1000000000};
+  const int bits = 32 - __builtin_clz(value | 1);
+  const int guess = (bits * 1233) >> 12;
+  return guess + 1 - (value < powers_of_10[guess]);
+}
+
+char *lzcnt_itoa(char *out, int32_t value) {
+  uint32_t u = itoa_magnitude(out, value);
+
+  const int digits = itoa_digit_count(u);
+  char *p = out + digits;
+  while (u >= 100) {
+    p -= 2;
+    memcpy(p, digit_pairs.pairs + (u % 100) * 2, 2);
+    u /= 100;
+  }
+  itoa_leading_digits(out, u);
+  return out + digits;
+}
+
+BENCHMARK_DEFINE_F(string_data_fixture, lzcnt_itoa)(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (const auto &[str, integer] : values) {
+      char buffer[16];
+      const char *end = lzcnt_itoa(buffer, integer);
+      assert(std::string_view(buffer, end - buffer) == str);
+      assert(simd_atoi(buffer, end) == integer);
+      benchmark::DoNotOptimize(end);
+      benchmark::DoNotOptimize(buffer);
+    }
+  }
+}
+
+BENCH(lzcnt_itoa);
+
+/**
+ * https://github.com/jeaiii/itoa
+ * value / 10^k as a 32.32 fixed point number, so the integer part holds the
+ * leading digits. Every further pair is the integer part of the fraction
+ * times 100, no division in the loop. Multipliers are ceil(2^n / 10^k), so
+ * the fraction never drops below the exact one and the error stays small
+ * enough not to carry into the next pair.
+ **/
+static inline char *jeaiii_pairs(char *out, uint64_t fixed, int pairs) {
+  for (int i = 0; i < pairs; i++) {
+    fixed = uint64_t(uint32_t(fixed)) * 100;
+    memcpy(out, digit_pairs.pairs + (fixed >> 32) * 2, 2);
+    out += 2;
+  }
+  return out;
+}
+
+// value < 10^8 over 10^6, 32 bits of fraction lack the precision for 3 pairs
+static inline uint64_t jeaiii_fixed_8(uint32_t value) {
+  return ((uint64_t(value) * 281474977) >> 16) + 1;
+}
+
+// value < 10^8, padded to an even digit count of 2 * (pairs + 1)
+static inline char *jeaiii_fixed(char *out, uint32_t value, int pairs) {
+  uint64_t fixed;
+  switch (pairs) {
+  case 1: // 3-4 digits, value / 10^2
+    fixed = uint64_t(value) * 42949673;
+    break;
+  case 2: // 5-6 digits, value / 10^4
+    fixed = uint64_t(value) * 429497;
+    break;
+  default: // 7-8 digits, value / 10^6
+    fixed = jeaiii_fixed_8(value);
+    break;
+  }
+  out = itoa_leading_digits(out, uint32_t(fixed >> 32));
+  return jeaiii_pairs(out, fixed, pairs);
+}
+
+char *jeaiii_itoa(char *out, int32_t value) {
+  const uint32_t u = itoa_magnitude(out, value);
+
+  if (u < 100)
+    return itoa_leading_digits(out, u);
+  if (u < 10000)
+    return jeaiii_fixed(out, u, 1);
+  if (u < 1000000)
+    return jeaiii_fixed(out, u, 2);
+  if (u < 100000000)
+    return jeaiii_fixed(out, u, 3);
+
+  // 9-10 digits, leading digits / 10^8 then 8 zero padded ones
+  const uint32_t low = u % 100000000;
+  out = itoa_leading_digits(out, u / 100000000);
+  const uint64_t fixed = jeaiii_fixed_8(low);
+  memcpy(out, digit_pairs.pairs + (fixed >> 32) * 2, 2);
+  return jeaiii_pairs(out + 2, fixed, 3);
+}
+
+BENCHMARK_DEFINE_F(string_data_fixture, jeaiii_itoa)(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (const auto &[str, integer] : values) {
+      char buffer[16];
+      const char *end = jeaiii_itoa(buffer, integer);
+      assert(std::string_view(buffer, end - buffer) == str);
+      assert(simd_atoi(buffer, end) == integer);
+      benchmark::DoNotOptimize(end);
+      benchmark::DoNotOptimize(buffer);
+    }
+  }
+}
+
+BENCH(jeaiii_itoa);
+
+// Baseline 1
+BENCHMARK_DEFINE_F(string_data_fixture, std_to_chars)
+(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (const auto &[str, integer] : values) {
+      char buffer[16];
+      const char *end = std::to_chars(buffer, buffer + sizeof(buffer), integer).ptr;
+      [[maybe_unused]] int32_t val = 0;
+      assert(swar_atoi(buffer, end, val) && val == integer);
+      benchmark::DoNotOptimize(end);
+      benchmark::DoNotOptimize(buffer);
+    }
+  }
+}
+
+BENCH(std_to_chars);
+
+// Baseline 2
+BENCHMARK_DEFINE_F(string_data_fixture, std_to_string)
+(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (const auto &[str, integer] : values) {
+      const std::string val = std::to_string(integer);
+      assert(val == str);
+      benchmark::DoNotOptimize(val.data());
+    }
+  }
+}
+
+BENCH(std_to_string);
+
+/*
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+ */
+
+/**
+ * Decimal strings to double, e.g. prices and dimensions in 2.inventory.
+ * range(0) mantissa digits, more than 19 take the fallback path.
+ * range(1) exponent digits, 0 for none.
+ **/
+class decimal_data_fixture : public ::benchmark::Fixture {
+public:
+  void SetUp(const ::benchmark::State &st) {
+    const int mantissa_digits = st.range(0);
+    const int exponent_digits = st.range(1);
+    std::random_device rd;
+    std::mt19937 gen{rd()};
+    std::uniform_int_distribution<> dis{0, 9};
+    std::uniform_int_distribution<> point{1, mantissa_digits};
+    // 3 digit exponents stay clear of overflow and subnormals
+    static constexpr int exponent_max[]{0, 9, 99, 280};
+
+    values.reserve(1000);
+    for (int n = 0; n < 1000; ++n) {
+      std::string str;
+      if (dis(gen) >= 5) {
+        str += '-';
+      }
+      const int dot = point(gen);
+      for (int i = 0; i < mantissa_digits; i++) {
+        if (i == dot) {
+          str += '.';
+        }
+        str += char('0' + (i == 0 ? 1 + dis(gen) % 9 : dis(gen)));
+      }
+      if (exponent_digits > 0) {
+        const int min = exponent_digits == 1 ? 0 : exponent_max[exponent_digits - 1] + 1;
+        std::uniform_int_distribution<> exponent{min, exponent_max[exponent_digits]};
+        str += dis(gen) >= 5 ? "e-" : "e";
+        str += std::to_string(exponent(gen));
+      }
+      values.emplace_back(str, strtod(str.c_str(), nullptr));
+    }
+  }
+
+  void TearDown(const ::benchmark::State &) { values.clear(); }
+
+  std::vector<std::pair<std::string, double>> values;
+};
+
+#define BENCH_DECIMAL(test)                                                    \
+  BENCHMARK_REGISTER_F(decimal_data_fixture, test)                             \
+      ->ArgsProduct({{1, 4, 8, 12, 16, 19, 24}, {0, 1, 2, 3}});
+
+/**
+ * https://arxiv.org/abs/2101.11408 (Eisel-Lemire)
+ * Mantissa w of up to 19 digits times 10^q. Small exact cases multiply in
+ * double (Clinger), the rest multiply w by a 128 bit truncated 5^q and keep
+ * the top 54 bits. Anything the fast path can't round correctly - more
+ * digits, an ambiguous product, subnormals, overflow, inf and nan - goes to
+ * from_chars.
+ **/
+struct power_of_five_table {
+  static constexpr int smallest = -342;
+  static constexpr int largest = 308;
+
+  constexpr power_of_five_table() : entries{} {
+    // 5^q, exact then truncated
+    uint32_t big[limbs]{1};
+    for (int q = 0; q <= largest; q++) {
+      top_bits(big, entries[q - smallest]);
+      multiply(big, 5);
+    }
+    // 2^b / 5^-q, truncated and rounded up while that stays below 128 bits
+    uint32_t reciprocal[limbs]{};
+    reciprocal[limbs - 1] = 1;
+    for (int q = -1; q >= smallest; q--) {
+      divide(reciprocal, 5);
+      uint64_t *entry = entries[q - smallest];
+      top_bits(reciprocal, entry);
+      if (q >= -27) {
+        entry[1] += 1;
+        entry[0] += entry[1] == 0;
+      }
+    }
+  }
+
+  uint64_t entries[largest - smallest + 1][2];
+
+private:
+  static constexpr int limbs = 34;
+
+  static constexpr void multiply(uint32_t *big, uint32_t factor) {
+    uint64_t carry = 0;
+    for (int i = 0; i < limbs; i++) {
+      carry += uint64_t(big[i]) * factor;
+      big[i] = uint32_t(carry);
+      carry >>= 32;
+    }
+  }
+
+  static constexpr void divide(uint32_t *big, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (int i = limbs - 1; i >= 0; i--) {
+      remainder = (remainder << 32) | big[i];
+      big[i] = uint32_t(remainder / divisor);
+      remainder %= divisor;
+    }
+  }
+
+  // The 128 bits from the most significant one down, zeros below bit 0
+  static constexpr void top_bits(const uint32_t *big, uint64_t *entry) {
+    int top = limbs * 32 - 1;
+    while (((big[top / 32] >> (top % 32)) & 1) == 0) {
+      top--;
+    }
+    for (int i = 0; i < 128; i++) {
+      const int bit = top - i;
+      const uint64_t value = bit < 0 ? 0 : (big[bit / 32] >> (bit % 32)) & 1;
+      entry[i / 64] |= value << (63 - i % 64);
+    }
+  }
+};
+
+static constexpr power_of_five_table powers_of_five{};
+
+// false when the result needs the slow path
+static inline bool eisel_lemire(uint64_t w, int64_t q, double &value) {
+  static constexpr double exact_powers_of_10[]{
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  if (w == 0) {
+    value = 0;
+    return true;
+  }
+  if ((w <= (uint64_t(1) << 53)) & (q >= -22) & (q <= 22)) {
+    value = q < 0 ? double(w) / exact_powers_of_10[-q]
+                  : double(w) * exact_powers_of_10[q];
+    return true;
+  }
+  if ((q < power_of_five_table::smallest) | (q > power_of_five_table::largest))
+    return false;
+
+  const int lz = __builtin_clzll(w);
+  w <<= lz;
+
+  // 55 bits of product are needed, the low entry only when they may carry
+  const uint64_t *entry = powers_of_five.entries[q - power_of_five_table::smallest];
+  unsigned __int128 product = (unsigned __int128)w * entry[0];
+  uint64_t high = uint64_t(product >> 64);
+  uint64_t low = uint64_t(product);
+  if ((high & 0x1FF) == 0x1FF) {
+    const uint64_t second = uint64_t(((unsigned __int128)w * entry[1]) >> 64);
+    low += second;
+    high += low < second;
+    if (low == ~uint64_t(0))
+      return false;
+  }
+
+  const int upper_bit = int(high >> 63);
+  const int shift = upper_bit + 9;
+  uint64_t mantissa = high >> shift;
+  // floor(log2(10^q)) + 63, biased
+  int64_t power2 = ((217706 * q) >> 16) + 63 + upper_bit - lz + 1023;
+  if (power2 <= 0)
+    return false;
+
+  // Exactly half way, round to even instead of up
+  if ((low <= 1) & (q >= -4) & (q <= 23) & ((mantissa & 3) == 1) &&
+      (mantissa << shift) == high) {
+    mantissa &= ~uint64_t(1);
+  }
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >= (uint64_t(2) << 52)) {
+    mantissa = uint64_t(1) << 52;
+    power2++;
+  }
+  if (power2 >= 0x7FF)
+    return false;
+
+  const uint64_t bits = (mantissa & ~(uint64_t(1) << 52)) | uint64_t(power2) << 52;
+  memcpy(&value, &bits, sizeof(value));
+  return true;
+}
+
+// Appends the digits at str to w, 8 at a time with the SWAR helpers
+static inline const char *atof_digits(const char *str, const char *end,
+                                      uint64_t &w) {
+  while (end - str >= 8) {
+    const uint64_t chunk = swar_load(str, 8);
+    if (!swar_is_digits(chunk))
+      break;
+    w = w * 100000000 + swar_combine(chunk);
+    str += 8;
+  }
+  for (uint8_t c; str < end && (c = uint8_t(*str) - '0') <= 9; ++str) {
+    w = w * 10 + c;
+  }
+  return str;
+}
+
+std::from_chars_result lemire_from_chars(const char *first, const char *last,
+                                         double &value) {
+  const char *str = first;
+  const bool negative = str < last && *str == '-';
+  str += negative;
+
+  uint64_t w = 0;
+  const char *digits = str;
+  str = atof_digits(str, last, w);
+  int64_t count = str - digits;
+  int64_t q = 0;
+  if (str < last && *str == '.') {
+    const char *fraction = ++str;
+    str = atof_digits(str, last, w);
+    q = fraction - str;
+    count -= q;
+  }
+  // No digits, inf, nan or not a number at all
+  if (count == 0)
+    return std::from_chars(first, last, value);
+
+  // w wrapped past 19 digits, unless all but 19 are leading zeros
+  bool truncated = false;
+  if (count > 19) {
+    for (const char *zero = digits; zero < str && (*zero == '0' || *zero == '.');
+         ++zero) {
+      count -= *zero == '0';
+    }
+    truncated = count > 19;
+  }
+
+  // Without digits the exponent is not part of the number
+  if (str < last && (*str | 0x20) == 'e') {
+    const char *mark = str++;
+    const bool negative_exponent = str < last && *str == '-';
+    str += negative_exponent | (str < last && *str == '+');
+    const char *exponent_digits = str;
+    int64_t exponent = 0;
+    for (uint8_t c; str < last && (c = uint8_t(*str) - '0') <= 9; ++str) {
+      exponent = exponent < 0x10000 ? exponent * 10 + c : exponent;
+    }
+    if (str == exponent_digits) {
+      str = mark;
+    } else {
+      q += negative_exponent ? -exponent : exponent;
+    }
+  }
+
+  double result;
+  if (truncated || !eisel_lemire(w, q, result))
+    return std::from_chars(first, str, value);
+  value = negative ? -result : result;
+  return {str, std::errc{}};
+}
+
+BENCHMARK_DEFINE_F(decimal_data_fixture, lemire_from_chars)
+(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (const auto &[str, number] : values) {
+      double val = 0;
+      const auto result =
+          lemire_from_chars(str.c_str(), str.c_str() + str.length(), val);
+      assert(result.ec == std::errc{} && val == number);
+      benchmark::DoNotOptimize(result);
+      benchmark::DoNotOptimize(&val);
+    }
+  }
+}
+
+BENCH_DECIMAL(lemire_from_chars);
+
+// Baseline 1
+BENCHMARK_DEFINE_F(decimal_data_fixture, std_strtod)
+(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (const auto &[str, number] : values) {
+      const auto val = strtod(str.c_str(), nullptr);
+      assert(val == number);
+      benchmark::DoNotOptimize(&val);
+    }
+  }
+}
+
+BENCH_DECIMAL(std_strtod);
+
+// Baseline 2
+BENCHMARK_DEFINE_F(decimal_data_fixture, std_from_chars_double)
+(benchmark::State &state) {
+
+  for (auto _ : state) {
+    for (const auto &[str, number] : values) {
+      double val = 0;
+      std::from_chars(str.c_str(), str.c_str() + str.length(), val);
+      assert(val == number);
+      benchmark::DoNotOptimize(&val);
+    }
+  }
+}
+
+BENCH_DECIMAL(std_from_chars_double);
+
+/*
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+ */
+
+/**
+ * std::from_chars compatible parsing of [first, last), for zero copy slices
+ * of a larger buffer. Nothing past last is read, ptr points past the digits
+ * and ec reports invalid input or overflow, leaving value untouched.
+ **/
+// Fewer than 8 bytes as two overlapping loads, zeros above them
+static inline uint64_t swar_load_partial(const char *str, size_t len) {
+  if (len >= 4) {
+    uint32_t low, high;
+    memcpy(&low, str, 4);
+    memcpy(&high, str + len - 4, 4);
+    return low | uint64_t(high) << (8 * (len - 4));
+  }
+  if (len >= 2) {
+    uint16_t low, high;
+    memcpy(&low, str, 2);
+    memcpy(&high, str + len - 2, 2);
+    return low | uint64_t(high) << (8 * (len - 2));
+  }
+  return len == 1 ? uint8_t(*str) : 0;
+}
+
+// Number of leading digits in the up to 8 bytes at str, all loaded to chunk
+static inline int swar_digit_prefix(const char *str, const char *last,
+                                    uint64_t &chunk) {
+  const size_t available = last - str;
+  if (available >= 8) {
+    memcpy(&chunk, str, 8);
+  } else {
+    chunk = swar_load_partial(str, available);
+  }
+  const uint64_t non_digits =
+      ((chunk & 0xF0F0F0F0F0F0F0F0ull) |
+       (((chunk + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) ^
+      0x3333333333333333ull;
+  return non_digits == 0 ? 8 : __builtin_ctzll(non_digits) / 8;
+}
+
+// Inlined into the caller's loop, the call alone costs as much as 1-3 digits
+template <typename T>
+__attribute__((always_inline)) inline std::from_chars_result
+fast_from_chars(const char *first, const char *last, T &value) {
+  static constexpr uint64_t powers_of_10[]{
+      1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+  const bool negative = std::is_signed_v<T> && first < last && *first == '-';
+  const char *str = first + negative;
+
+  uint64_t chunk;
+  int digits = swar_digit_prefix(str, last, chunk);
+  if (digits == 0)
+    return {first, std::errc::invalid_argument};
+
+  // Digits moved to the top bytes, as swar_load leaves them
+  uint64_t magnitude = swar_combine(chunk << (64 - 8 * digits));
+  bool overflow = false;
+  for (str += digits; digits == 8; str += digits) {
+    digits = swar_digit_prefix(str, last, chunk);
+    if (digits == 0)
+      break;
+    overflow |= __builtin_mul_overflow(magnitude, powers_of_10[digits],
+                                       &magnitude) |
+                __builtin_add_overflow(
+                    magnitude, uint64_t(swar_combine(chunk << (64 - 8 * digits))),
+                    &magnitude);
+  }
+
+  using U = std::make_unsigned_t<T>;
+  const uint64_t limit =
+      uint64_t(std::numeric_limits<T>::max()) + (std::is_signed_v<T> & negative);
+  if (overflow | (magnitude > limit))
+    return {str, std::errc::result_out_of_range};
+
+  value = T(negative ? U(0) - U(magnitude) : U(magnitude));
+  return {str, std::errc{}};
+}
+
+/**
+ * The values of a fixture back to back in one buffer, no delimiter or
+ * terminator after a slice. A parser reading past its slice runs into the
+ * next number.
+ **/
+template <typename Fixture> class slice_data_fixture : public Fixture {
+public:
+  using value_type =
+      typename decltype(Fixture::values)::value_type::second_type;
+
+  void SetUp(const ::benchmark::State &st) {
+    Fixture::SetUp(st);
+
+    for (const auto &[str, number] : this->values) {
+      buffer += str;
+    }
+    slices.reserve(this->values.size());
+    size_t offset = 0;
+    for (const auto &[str, number] : this->values) {
+      slices.emplace_back(std::string_view(buffer).substr(offset, str.size()),
+                          number);
+      offset += str.size();
+    }
+  }
+
+  void TearDown(const ::benchmark::State &st) {
+    slices.clear();
+    buffer.clear();
+    Fixture::TearDown(st);
+  }
+
+  std::string buffer;
+  std::vector<std::pair<std::string_view, value_type>> slices;
+};
+
+#define SLICE_BENCH(test, fixture, parse)                                      \
+  BENCHMARK_TEMPLATE_DEFINE_F(slice_data_fixture, test, fixture)               \
+  (benchmark::State & state) {                                                 \
+    for (auto _ : state) {                                                     \
+      for (const auto &[str, number] : slices) {                               \
+        value_type val{};                                                      \
+        const char *end = str.data() + str.size();                             \
+        const auto result = parse(str.data(), end, val);                       \
+        assert(result.ec == std::errc{} && result.ptr == end &&                \
+               val == number);                                                 \
+        benchmark::DoNotOptimize(result);                                      \
+        benchmark::DoNotOptimize(&val);                                        \
+      }                                                                        \
+    }                                                                          \
+  }
+
+#define BENCH_SLICE(test, max_digits)                                          \
+  BENCHMARK_REGISTER_F(slice_data_fixture, test)->DenseRange(1, max_digits, 1);
+
+SLICE_BENCH(fast_from_chars_int32, string_data_fixture, fast_from_chars)
+BENCH_SLICE(fast_from_chars_int32, 10)
+
+SLICE_BENCH(from_chars_int32, string_data_fixture, std::from_chars)
+BENCH_SLICE(from_chars_int32, 10)
+
+SLICE_BENCH(fast_from_chars_int64, integer_data_fixture<int64_t>,
+            fast_from_chars)
+BENCH_SLICE(fast_from_chars_int64, 19)
+
+SLICE_BENCH(from_chars_int64, integer_data_fixture<int64_t>, std::from_chars)
+BENCH_SLICE(from_chars_int64, 19)
+
+SLICE_BENCH(lemire_from_chars, decimal_data_fixture, lemire_from_chars)
+BENCHMARK_REGISTER_F(slice_data_fixture, lemire_from_chars)
+    ->ArgsProduct({{1, 8, 16, 24}, {0, 3}});
+
+SLICE_BENCH(from_chars_double, decimal_data_fixture, std::from_chars)
+BENCHMARK_REGISTER_F(slice_data_fixture, from_chars_double)
+    ->ArgsProduct({{1, 8, 16, 24}, {0, 3}});
+
 BENCHMARK_MAIN();
@@ -2,13 +2,16 @@
 
 #include <libdivide.h>
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <limits>
 #include <new>
 
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 
 struct MemBlk {
@@ -60,7 +63,8 @@ template <typename A, typename B, size_t S> struct Partition {
                      : more.allocate(size, alignment);
   }
   void deallocate(MemBlk blk) {
-    if (less.owns(blk)) {
+    // A known size picks the side the same way allocate did
+    if (blk.size != 0 ? blk.size <= S : less.owns(blk)) {
       less.deallocate(blk);
     } else {
       more.deallocate(blk);
@@ -116,22 +120,96 @@ template <typename P> struct SizeAllocator {
   bool owns(MemBlk blk) { return primary.owns(blk); }
 };
 
+/*
+ * Control data of a single pool. It is kept free of template parameters so an
+ * owner found through the page map can release a block without knowing which
+ * PoolAllocator instantiation it belongs to.
+ */
+struct PoolControl {
+  size_t block_count;
+  size_t block_size;
+  size_t block_shift; // log2(block_size) when it is a power of two, else 0
+  size_t block_alignment;
+  divider_t block_divider;
+  memory_address memory_space_start;
+  memory_address control_block_start;
+  memory_address free_block_head;
+  memory_address *control_blocks;
+};
+
+static void pool_release(PoolControl &pool, void *ptr) noexcept {
+  // page_map::retired, the pool of the block was already destroyed
+  if (pool.control_blocks == nullptr) {
+    return;
+  }
+  const memory_address current = {ptr};
+  const size_t offset = size_t(current.addr - pool.memory_space_start.addr);
+
+  const size_t idx = pool.block_shift ? offset >> pool.block_shift
+                                      : offset / pool.block_divider;
+  pool.control_blocks[idx].ptr = pool.free_block_head.ptr;
+  pool.free_block_head.ptr = &pool.control_blocks[idx];
+}
+
+/*
+ * Two level radix tree mapping 4 KiB pages of the 48 bit address space to the
+ * pool owning them. Pools register their block space on construction, so an
+ * unsized delete resolves its owner with two loads instead of walking
+ * Partition/Fallback owns() on every level. Pages not in the map belong to
+ * the fallback Mallocator.
+ */
+namespace page_map {
+
+static constexpr size_t PAGE_SHIFT{12};
+static constexpr size_t PAGE_SIZE{size_t(1) << PAGE_SHIFT};
+static constexpr size_t ADDRESS_BITS{48};
+static constexpr size_t LEAF_BITS{18};
+static constexpr size_t ROOT_BITS{ADDRESS_BITS - PAGE_SHIFT - LEAF_BITS};
+
+using leaf_t = PoolControl *[size_t(1) << LEAF_BITS];
+
+static leaf_t *root[size_t(1) << ROOT_BITS];
+
+static constexpr size_t root_index(uintptr_t addr) noexcept {
+  return (addr >> (PAGE_SHIFT + LEAF_BITS)) & ((size_t(1) << ROOT_BITS) - 1);
+}
+
+static constexpr size_t leaf_index(uintptr_t addr) noexcept {
+  return (addr >> PAGE_SHIFT) & ((size_t(1) << LEAF_BITS) - 1);
+}
+
+static void assign(memory_address begin, size_t size, PoolControl *owner) {
+  for (uintptr_t addr = begin.addr, end = begin.addr + size; addr < end;
+       addr += PAGE_SIZE) {
+    leaf_t *&leaf = root[root_index(addr)];
+    if (leaf == nullptr) {
+      // calloc keeps the map out of the global operator new
+      leaf = static_cast<leaf_t *>(calloc(1, sizeof(leaf_t)));
+    }
+    (*leaf)[leaf_index(addr)] = owner;
+  }
+}
+
+// Owner of pages whose pool was destroyed, late deletes of its blocks, e.g.
+// from later static destructors or exiting threads, must not reach free()
+static PoolControl retired{};
+
+static PoolControl *lookup(void *ptr) noexcept {
+  const memory_address address{.ptr = ptr};
+  const leaf_t *leaf = root[root_index(address.addr)];
+  return leaf == nullptr ? nullptr : (*leaf)[leaf_index(address.addr)];
+}
+
+} // namespace page_map
+
 template <typename P, size_t S, size_t A, size_t C> struct PoolAllocator {
 
-  static constexpr size_t ALLOCATOR_ALIGN{64};
+  // Page aligned so that every mapped page is owned by this pool alone
+  static constexpr size_t ALLOCATOR_ALIGN{page_map::PAGE_SIZE};
 
   static constexpr size_t Size{align(S, A)};
 
-  struct {
-    size_t block_count;
-    size_t block_size;
-    size_t block_alignment;
-    divider_t block_divider;
-    memory_address memory_space_start;
-    memory_address control_block_start;
-    memory_address free_block_head;
-    memory_address *control_blocks;
-  } internal;
+  PoolControl internal;
 
   P parent;
   MemBlk parentAllocation;
@@ -141,12 +219,16 @@ template <typename P, size_t S, size_t A, size_t C> struct PoolAllocator {
     const size_t alinged_block_size = align(S, A);
     const size_t aligned_meta_size =
         align(C * sizeof(memory_address), ALLOCATOR_ALIGN);
-    const size_t required_size = aligned_meta_size + C * alinged_block_size;
+    const size_t required_size =
+        align(aligned_meta_size + C * alinged_block_size, ALLOCATOR_ALIGN);
 
     parentAllocation = parent.allocate(required_size, ALLOCATOR_ALIGN);
 
     internal.block_count = C;
     internal.block_size = alinged_block_size;
+    internal.block_shift = (alinged_block_size & (alinged_block_size - 1))
+                               ? 0
+                               : __builtin_ctzl(alinged_block_size);
     internal.block_alignment = A;
     internal.block_divider = alinged_block_size;
 
@@ -164,9 +246,17 @@ template <typename P, size_t S, size_t A, size_t C> struct PoolAllocator {
           allocator_mem_space.addr + (i + 1) * sizeof(memory_address);
     }
     internal.control_blocks[C - 1].ptr = nullptr;
+
+    page_map::assign(internal.memory_space_start, C * alinged_block_size,
+                     &internal);
   }
 
-  ~PoolAllocator() { parent.deallocate(parentAllocation); }
+  ~PoolAllocator() {
+    page_map::assign(internal.memory_space_start,
+                     internal.block_count * internal.block_size,
+                     &page_map::retired);
+    parent.deallocate(parentAllocation);
+  }
 
   MemBlk allocate(size_t size) {
 
@@ -215,13 +305,7 @@ template <typename P, size_t S, size_t A, size_t C> struct PoolAllocator {
 
     assert(blk.size == internal.block_size && "Unexpected dealocation size");
     assert(owns(blk) && "Unexpected not owned block");
-    const memory_address current = {blk.address};
-    const memory_address start = internal.memory_space_start;
-
-    const size_t idx =
-        size_t(current.addr - start.addr) / internal.block_divider;
-    internal.control_blocks[idx].ptr = internal.free_block_head.ptr;
-    internal.free_block_head.ptr = &internal.control_blocks[idx];
+    pool_release(internal, blk.address);
   }
 
   bool owns(MemBlk blk) {
@@ -253,8 +337,15 @@ using MyAlloc =
 // Total allocation 1.607 Gb
 
 #ifdef CUSTOM
+// Cleared once the allocator is destroyed, sized deletes after that resolve
+// their pool through the page map like unsized ones
+static bool alive = true;
+
 static MyAlloc &allocator() {
-  static MyAlloc alloc;
+  // The destructor body runs before the pools are destroyed
+  static struct Instance : MyAlloc {
+    ~Instance() { alive = false; }
+  } alloc;
   return alloc;
 }
 #endif
@@ -376,25 +467,131 @@ void end() {
 }
 } // namespace memory_profile
 
+namespace memory_trace {
+#ifdef TRACER
+
+using clock_t = std::chrono::steady_clock;
+
+static constexpr size_t BUFFER_RECORDS{4096};
+
+struct {
+  FILE *file{nullptr};
+  clock_t::time_point start{};
+  std::mutex lock{};
+  std::atomic<uint16_t> thread_count{0};
+  std::atomic<bool> collect{false};
+} tracer;
+
+static void flush(const Record *records, size_t count) {
+  std::lock_guard<std::mutex> guard(tracer.lock);
+  if (tracer.file != nullptr) {
+    fwrite(records, sizeof(Record), count, tracer.file);
+  }
+}
+
+// Records are batched per thread and written in bulk, fwrite never reaches
+// the global operator new
+struct ThreadBuffer {
+  uint16_t thread{tracer.thread_count.fetch_add(1, std::memory_order_relaxed)};
+  size_t count{0};
+  Record records[BUFFER_RECORDS];
+
+  ~ThreadBuffer() { flush(records, count); }
+};
+
+static ThreadBuffer &thread_buffer() {
+  static thread_local ThreadBuffer buffer;
+  return buffer;
+}
+
+static void record(Op op, void *ptr, size_t size, size_t alignment) {
+  if (!tracer.collect.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  ThreadBuffer &buffer = thread_buffer();
+  const memory_address address{.ptr = ptr};
+  const auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             clock_t::now() - tracer.start)
+                             .count();
+
+  buffer.records[buffer.count++] = {address.addr, size, uint64_t(timestamp),
+                                    uint32_t(alignment), buffer.thread, op};
+  if (buffer.count == BUFFER_RECORDS) {
+    flush(buffer.records, buffer.count);
+    buffer.count = 0;
+  }
+}
+#endif
+
+void begin([[maybe_unused]] const char *path) {
+#ifdef TRACER
+  std::lock_guard<std::mutex> guard(tracer.lock);
+  if (tracer.file != nullptr) {
+    fclose(tracer.file);
+  }
+  tracer.file = fopen(path, "wb");
+  tracer.start = clock_t::now();
+  tracer.collect.store(tracer.file != nullptr, std::memory_order_relaxed);
+#endif
+}
+
+void end() {
+#ifdef TRACER
+  tracer.collect.store(false, std::memory_order_relaxed);
+
+  ThreadBuffer &buffer = thread_buffer();
+  flush(buffer.records, buffer.count);
+  buffer.count = 0;
+
+  std::lock_guard<std::mutex> guard(tracer.lock);
+  if (tracer.file != nullptr) {
+    fclose(tracer.file);
+    tracer.file = nullptr;
+  }
+#endif
+}
+} // namespace memory_trace
+
 static void *allocate(size_t size) {
 #ifdef CUSTOM
-  return custom_alloc::allocator().allocate(size).address;
+  void *ptr = custom_alloc::allocator().allocate(size).address;
 #else
-  return malloc(size);
+  void *ptr = malloc(size);
+#endif
+#ifdef TRACER
+  memory_trace::record(memory_trace::Op::Allocate, ptr, size, 0);
 #endif
+  return ptr;
 }
 
 static void *allocate(size_t al, size_t size) {
 #ifdef CUSTOM
-  return custom_alloc::allocator().allocate(size, al).address;
+  void *ptr = custom_alloc::allocator().allocate(size, al).address;
 #else
-  return aligned_alloc(al, size);
+  void *ptr = aligned_alloc(al, size);
 #endif
+#ifdef TRACER
+  memory_trace::record(memory_trace::Op::Allocate, ptr, size, al);
+#endif
+  return ptr;
 }
 
 static void deallocate(void *ptr, size_t size) {
+#ifdef TRACER
+  memory_trace::record(memory_trace::Op::Deallocate, ptr, size, 0);
+#endif
 #ifdef CUSTOM
-  custom_alloc::allocator().deallocate({ptr, size});
+  // A sized delete picks the pool by size the same way allocate did, an
+  // unsized one asks the page map. Every Fallback in MyAlloc ends in
+  // Mallocator, so anything the page map does not know about came from malloc
+  if (size != 0 && custom_alloc::alive) {
+    custom_alloc::allocator().deallocate({ptr, size});
+  } else if (PoolControl *pool = page_map::lookup(ptr)) {
+    pool_release(*pool, ptr);
+  } else {
+    free(ptr);
+  }
 #else
   free(ptr);
 #endif
@@ -469,7 +666,7 @@ void *operator new(std::size_t count, const std::nothrow_t &) {
                  memory_profile::data.current_alloc_size);
   }
 #endif
-  return allocate(0, count);
+  return allocate(count);
 }
 
 void *operator new[](std::size_t count, const std::nothrow_t &) {
@@ -482,7 +679,7 @@ void *operator new[](std::size_t count, const std::nothrow_t &) {
                  memory_profile::data.current_alloc_size);
   }
 #endif
-  return allocate(0, count);
+  return allocate(count);
 }
 
 void *operator new(std::size_t count, std::align_val_t al,
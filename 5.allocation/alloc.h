@@ -5,10 +5,38 @@
 
 // #define PRINTER
 
+// #define TRACER
+
+#include <cstdint>
+
 namespace memory_profile {
 void begin();
 void clear();
 void end();
 } // namespace memory_profile
 
+/*
+ * Binary allocation trace. With TRACER defined every operator new/delete
+ * between begin() and end() is appended to the file as a Record.
+ * Threads should be joined before end(), their buffers flush on exit.
+ */
+namespace memory_trace {
+
+enum class Op : uint8_t { Allocate = 0, Deallocate = 1 };
+
+struct Record {
+  uint64_t address;   // pairs a deallocation with its allocation
+  uint64_t size;      // 0 for unsized delete
+  uint64_t timestamp; // nanoseconds since begin()
+  uint32_t alignment; // 0 for default alignment
+  uint16_t thread;
+  Op op;
+};
+
+static_assert(sizeof(Record) == 32, "Trace record layout changed");
+
+void begin(const char *path);
+void end();
+} // namespace memory_trace
+
 #endif // ALLOC_H
\ No newline at end of file
@@ -4,4 +4,9 @@ namespace memory_profile {
 void begin() {}
 void clear() {}
 void end() {}
-} // namespace memory_profile
\ No newline at end of file
+} // namespace memory_profile
+
+namespace memory_trace {
+void begin(const char *) {}
+void end() {}
+} // namespace memory_trace
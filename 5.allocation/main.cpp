@@ -4,9 +4,12 @@
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <memory>
+#include <new>
 #include <random>
 #include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -14,6 +17,10 @@
 
 #include <benchmark/benchmark.h>
 
+static constexpr size_t align_up(size_t size, size_t alignment) noexcept {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
 class BenchObject {
 
 public:
@@ -62,6 +69,9 @@ static void memory_alloc_stress_test(benchmark::State &state) {
   std::uniform_real_distribution<float> dimention(1, 20);
 
   memory_profile::begin();
+  if (const char *path = getenv("ALLOC_TRACE_OUT")) {
+    memory_trace::begin(path);
+  }
 
   for (auto _ : state) {
 
@@ -95,6 +105,7 @@ static void memory_alloc_stress_test(benchmark::State &state) {
     }
   }
 
+  memory_trace::end();
   memory_profile::end();
 }
 
@@ -170,6 +181,282 @@ static void memory_alloc_stress_test_soa(benchmark::State &state) {
   memory_profile::end();
 }
 
+static void delete_churn(benchmark::State &state, bool sized) {
+  const size_t live_count = state.range(0);
+
+  // Mix of pooled sizes and sizes that spill into the malloc fallback
+  constexpr size_t sizes[]{24, 64, 512, 4096, 40000, 100000};
+  constexpr size_t sizes_count = sizeof(sizes) / sizeof(size_t);
+
+  std::vector<void *> live(live_count);
+  for (size_t i = 0; i < live_count; ++i) {
+    live[i] = ::operator new(sizes[i % sizes_count]);
+  }
+
+  for (auto _ : state) {
+    for (size_t i = 0; i < live_count; ++i) {
+      const size_t size = sizes[i % sizes_count];
+      if (sized) {
+        ::operator delete(live[i], size);
+      } else {
+        ::operator delete(live[i]);
+      }
+      live[i] = ::operator new(size);
+      benchmark::DoNotOptimize(live[i]);
+    }
+  }
+
+  for (size_t i = 0; i < live_count; ++i) {
+    ::operator delete(live[i]);
+  }
+
+  state.SetItemsProcessed(state.iterations() * live_count);
+}
+
+static void memory_delete_churn_unsized(benchmark::State &state) {
+  delete_churn(state, false);
+}
+
+static void memory_delete_churn_sized(benchmark::State &state) {
+  delete_churn(state, true);
+}
+
+/*
+ * Trace replay. The trace named by ALLOC_TRACE (see memory_trace in alloc.h)
+ * is turned into slot indexed operations up front, so replay does no lookups.
+ * Without ALLOC_TRACE a synthetic trace with random sizes and lifetimes is
+ * used. Threads flush their records in batches, so the file is sorted by
+ * timestamp first and replayed in that order on the benchmark thread.
+ * Recorded unsized deletes are replayed unsized.
+ *
+ * ALLOC_TRACE_OUT=file records the allocations of memory_alloc_stress_test
+ * into file for replay, alloc.h has to define TRACER. Every run of the stress
+ * test overwrites the file, so it keeps the last (largest) one.
+ */
+struct ReplayOp {
+  uint64_t size; // of a Deallocate 0 when it was unsized
+  uint32_t slot;
+  uint32_t alignment;
+  memory_trace::Op op;
+};
+
+struct ReplayTrace {
+  std::vector<ReplayOp> ops;
+  size_t slot_count{0};
+  size_t total_allocation{0};
+};
+
+static std::vector<memory_trace::Record> load_trace(const char *path) {
+  std::vector<memory_trace::Record> records;
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return records;
+  }
+
+  memory_trace::Record record;
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+    records.push_back(record);
+  }
+  fclose(file);
+  return records;
+}
+
+static std::vector<memory_trace::Record> synthetic_trace(size_t op_count) {
+  std::vector<memory_trace::Record> records;
+  records.reserve(op_count);
+
+  std::default_random_engine re(42);
+  std::uniform_int_distribution<int> size_shift(3, 12);
+  std::uniform_int_distribution<int> coin(0, 1);
+
+  // Address and size of the live allocations, frees are sized
+  std::vector<std::pair<uint64_t, uint64_t>> live;
+  uint64_t next_address = 1;
+  for (size_t i = 0; i < op_count; ++i) {
+    if (!live.empty() && coin(re)) {
+      std::uniform_int_distribution<size_t> pick(0, live.size() - 1);
+      const size_t idx = pick(re);
+      const auto [address, size] = live[idx];
+      records.push_back(
+          {address, size, i, 0, 0, memory_trace::Op::Deallocate});
+      live[idx] = live.back();
+      live.pop_back();
+    } else {
+      const uint64_t size = uint64_t(1) << size_shift(re);
+      records.push_back({next_address, size, i, 0, 0,
+                         memory_trace::Op::Allocate});
+      live.emplace_back(next_address++, size);
+    }
+  }
+  return records;
+}
+
+static ReplayTrace prepare_trace(std::vector<memory_trace::Record> records) {
+  // Stable, so records of one thread that share a timestamp keep their order
+  std::stable_sort(records.begin(), records.end(),
+                   [](const auto &lhs, const auto &rhs) {
+                     return lhs.timestamp < rhs.timestamp;
+                   });
+
+  ReplayTrace trace;
+  trace.ops.reserve(records.size());
+
+  std::unordered_map<uint64_t, uint32_t> live;
+  std::vector<uint32_t> free_slots;
+
+  for (const auto &record : records) {
+    if (record.op == memory_trace::Op::Allocate) {
+      uint32_t slot = trace.slot_count;
+      if (free_slots.empty()) {
+        trace.slot_count++;
+      } else {
+        slot = free_slots.back();
+        free_slots.pop_back();
+      }
+      live[record.address] = slot;
+      // Worst case padding in front of the block is its alignment
+      trace.total_allocation +=
+          align_up(record.size, std::max<size_t>(record.alignment, 64)) +
+          record.alignment;
+      trace.ops.push_back({record.size, slot, record.alignment, record.op});
+    } else {
+      // Skip frees of memory allocated before the trace started
+      const auto it = live.find(record.address);
+      if (it == live.end()) {
+        continue;
+      }
+      trace.ops.push_back({record.size, it->second, 0, record.op});
+      free_slots.push_back(it->second);
+      live.erase(it);
+    }
+  }
+  return trace;
+}
+
+static const ReplayTrace &replay_trace() {
+  static const ReplayTrace trace = [] {
+    const char *path = getenv("ALLOC_TRACE");
+    return prepare_trace(path != nullptr ? load_trace(path)
+                                         : synthetic_trace(1000000));
+  }();
+  return trace;
+}
+
+// Global operator new/delete, which is MyAlloc when alloc.h defines CUSTOM
+struct GlobalNewReplay {
+  void *allocate(size_t size, size_t alignment) {
+    return alignment ? ::operator new(size, std::align_val_t(alignment))
+                     : ::operator new(size);
+  }
+  // size 0 replays an unsized delete
+  void deallocate(void *ptr, size_t size, size_t alignment) {
+    if (alignment && size) {
+      ::operator delete(ptr, size, std::align_val_t(alignment));
+    } else if (alignment) {
+      ::operator delete(ptr, std::align_val_t(alignment));
+    } else if (size) {
+      ::operator delete(ptr, size);
+    } else {
+      ::operator delete(ptr);
+    }
+  }
+  void reset() {}
+};
+
+struct GlibcReplay {
+  void *allocate(size_t size, size_t alignment) {
+    return alignment ? aligned_alloc(alignment, align_up(size, alignment))
+                     : malloc(size);
+  }
+  void deallocate(void *ptr, size_t, size_t) { free(ptr); }
+  void reset() {}
+};
+
+// Bump allocator sized for the whole trace, frees are no-ops
+struct ArenaReplay {
+  char *memory{nullptr};
+  size_t capacity{0};
+  size_t offset{0};
+
+  explicit ArenaReplay(size_t size)
+      : memory(static_cast<char *>(aligned_alloc(64, align_up(size, 64)))),
+        capacity(align_up(size, 64)) {}
+  ~ArenaReplay() { free(memory); }
+
+  void *allocate(size_t size, size_t alignment) {
+    const uintptr_t base = reinterpret_cast<uintptr_t>(memory);
+    offset = align_up(base + offset, alignment ? alignment : 16) - base;
+    if (offset + size > capacity) {
+      fprintf(stderr, "ArenaReplay: trace does not fit in %lu bytes\n",
+              capacity);
+      abort();
+    }
+    void *ptr = memory + offset;
+    offset += size;
+    return ptr;
+  }
+  void deallocate(void *, size_t, size_t) {}
+  void reset() { offset = 0; }
+};
+
+template <typename Allocator>
+static void replay(benchmark::State &state, Allocator &allocator) {
+  const ReplayTrace &trace = replay_trace();
+  if (trace.ops.empty()) {
+    state.SkipWithError("Allocation trace is empty");
+    return;
+  }
+
+  struct Slot {
+    void *ptr;
+    uint64_t size;
+    uint32_t alignment;
+  };
+  std::vector<Slot> slots(trace.slot_count, Slot{nullptr, 0, 0});
+
+  for (auto _ : state) {
+    for (const auto &op : trace.ops) {
+      Slot &slot = slots[op.slot];
+      if (op.op == memory_trace::Op::Allocate) {
+        slot = {allocator.allocate(op.size, op.alignment), op.size,
+                op.alignment};
+        benchmark::DoNotOptimize(slot.ptr);
+      } else {
+        allocator.deallocate(slot.ptr, op.size != 0 ? slot.size : 0,
+                             slot.alignment);
+        slot.ptr = nullptr;
+      }
+    }
+
+    state.PauseTiming();
+    for (auto &slot : slots) {
+      if (slot.ptr != nullptr) {
+        allocator.deallocate(slot.ptr, slot.size, slot.alignment);
+        slot.ptr = nullptr;
+      }
+    }
+    allocator.reset();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * trace.ops.size());
+}
+
+static void memory_trace_replay_my_alloc(benchmark::State &state) {
+  GlobalNewReplay allocator;
+  replay(state, allocator);
+}
+
+static void memory_trace_replay_glibc(benchmark::State &state) {
+  GlibcReplay allocator;
+  replay(state, allocator);
+}
+
+static void memory_trace_replay_arena(benchmark::State &state) {
+  ArenaReplay allocator(replay_trace().total_allocation);
+  replay(state, allocator);
+}
+
 // Register the function as a benchmark
 BENCHMARK(memory_alloc_stress_test)
     ->Unit(benchmark::kMicrosecond)
@@ -189,4 +476,20 @@ BENCHMARK(memory_alloc_stress_test_soa)
     ->Args({405, 1620})
     ->Args({1215, 4860});
 
-BENCHMARK_MAIN();
+BENCHMARK(memory_delete_churn_unsized)
+    ->Unit(benchmark::kMicrosecond)
+    ->Arg(64)
+    ->Arg(1024)
+    ->Arg(16384);
+
+BENCHMARK(memory_delete_churn_sized)
+    ->Unit(benchmark::kMicrosecond)
+    ->Arg(64)
+    ->Arg(1024)
+    ->Arg(16384);
+
+BENCHMARK(memory_trace_replay_my_alloc)->Unit(benchmark::kMillisecond);
+BENCHMARK(memory_trace_replay_glibc)->Unit(benchmark::kMillisecond);
+BENCHMARK(memory_trace_replay_arena)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
\ No newline at end of file
@@ -1,9 +1,11 @@
 #include <benchmark/benchmark.h>
 
+#include <cstdlib>
 #include <random>
 #include <string_view>
 #include <vector>
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <utility>
@@ -33,32 +35,50 @@ class SaleFixture : public benchmark::Fixture {
       "VN", "VG", "VI", "WF", "EH", "YE", "ZM", "ZW", "AX"};
 
 public:
-  void SetUp(const ::benchmark::State &state) {}
-
-  void TearDown(const ::benchmark::State &state) {}
+  // A sale and the top N queried after it
+  struct Sale {
+    std::string_view countryCode;
+    int branchNumber;
+    int count;
+    int top;
+  };
 
-  std::string_view getCountryCode() {
-    return {country_codes[d_country_code(re)]};
+  static constexpr size_t sales_per_thread = 1 << 16;
+  static constexpr int max_threads = 64;
+
+  // Each thread draws its own buffer up front, the benchmarks cycle through
+  // it so no random numbers are drawn, or timers paused, while timing
+  void SetUp(const ::benchmark::State &state) {
+    if (state.thread_index() >= max_threads) {
+      std::abort();
+    }
+    std::seed_seq seq{seed, uint32_t(state.thread_index())};
+    std::default_random_engine re{seq};
+
+    std::uniform_int_distribution<int> d_country_code{
+        0, sizeof(country_codes) / sizeof(const char *) - 1};
+    std::uniform_int_distribution<int> d_branch_number{0, 99};
+    std::uniform_int_distribution<int> d_count{1, 50};
+    std::uniform_int_distribution<int> d_top{1, 1000};
+
+    auto &sales = buffers[state.thread_index()];
+    sales.resize(sales_per_thread);
+    for (auto &sale : sales) {
+      sale = {country_codes[d_country_code(re)], d_branch_number(re),
+              d_count(re), d_top(re)};
+    }
   }
 
-  int getBranchCode() { return d_branch_number(re); }
-
-  int count() { return d_count(re); }
+  void TearDown(const ::benchmark::State &state) {}
 
-  int getTopN() { return d_top(re); }
+  // The calling thread's i-th sale, wrapping around
+  const Sale &getSale(const ::benchmark::State &state, size_t i) const {
+    return buffers[state.thread_index()][i & (sales_per_thread - 1)];
+  }
 
 private:
-  std::random_device r;
-  std::default_random_engine re{r()};
-
-  std::uniform_int_distribution<int> d_country_code{
-      0, sizeof(country_codes) / sizeof(const char *) - 1};
-
-  std::uniform_int_distribution<int> d_branch_number{0, 99};
-
-  std::uniform_int_distribution<int> d_count{1, 50};
-
-  std::uniform_int_distribution<int> d_top{1, 1000};
+  const uint32_t seed = std::random_device{}();
+  std::vector<Sale> buffers[max_threads];
 };
 
 /*
@@ -123,17 +143,14 @@ static std::vector<Result> get_top_branches(int top) {
 } // namespace naive
 
 BENCHMARK_DEFINE_F(SaleFixture, naive_impl)(benchmark::State &state) {
+  size_t i = 0;
   for (auto _ : state) {
-    state.PauseTiming();
-    auto a = getCountryCode();
-    auto b = getBranchCode();
-    auto c = count();
-    auto d = getTopN();
-    state.ResumeTiming();
-    naive::record_vehicle_sale(a, b, c);
-    auto res = naive::get_top_branches(d);
+    const auto &sale = getSale(state, i++);
+    naive::record_vehicle_sale(sale.countryCode, sale.branchNumber, sale.count);
+    auto res = naive::get_top_branches(sale.top);
     benchmark::DoNotOptimize(res);
   }
+  state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK_REGISTER_F(SaleFixture, naive_impl);
@@ -214,17 +231,15 @@ static std::vector<Result> get_top_branches(int top) {
 } // namespace dev3years
 
 BENCHMARK_DEFINE_F(SaleFixture, dev3years_impl)(benchmark::State &state) {
+  size_t i = 0;
   for (auto _ : state) {
-    state.PauseTiming();
-    auto a = getCountryCode();
-    auto b = getBranchCode();
-    auto c = count();
-    auto d = getTopN();
-    state.ResumeTiming();
-    dev3years::record_vehicle_sale(a, b, c);
-    auto res = dev3years::get_top_branches(d);
+    const auto &sale = getSale(state, i++);
+    dev3years::record_vehicle_sale(sale.countryCode, sale.branchNumber,
+                                   sale.count);
+    auto res = dev3years::get_top_branches(sale.top);
     benchmark::DoNotOptimize(res);
   }
+  state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK_REGISTER_F(SaleFixture, dev3years_impl);
@@ -266,7 +281,10 @@ struct SetItem {
 std::vector<uint32_t> volumes;
 std::set<uint64_t, std::greater<>> ccbnSet;
 
-static void init() { volumes.resize(131071); }
+static void init() {
+  volumes.assign(131071, 0);
+  ccbnSet.clear();
+}
 
 static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
                                 int count) {
@@ -323,19 +341,456 @@ static std::vector<Result> get_top_branches(int top) {
 
 BENCHMARK_DEFINE_F(SaleFixture, eng_impl)(benchmark::State &state) {
   eng::init();
+  size_t i = 0;
   for (auto _ : state) {
-    state.PauseTiming();
-    auto a = getCountryCode();
-    auto b = getBranchCode();
-    auto c = count();
-    auto d = getTopN();
-    state.ResumeTiming();
-    eng::record_vehicle_sale(a, b, c);
-    auto res = eng::get_top_branches(d);
+    const auto &sale = getSale(state, i++);
+    eng::record_vehicle_sale(sale.countryCode, sale.branchNumber, sale.count);
+    auto res = eng::get_top_branches(sale.top);
     benchmark::DoNotOptimize(res);
   }
+  state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK_REGISTER_F(SaleFixture, eng_impl);
 
+// eng keys kept in a rank ordered flat array instead of a tree. Volumes only
+// grow, so a sale moves its key up past the entries it overtakes. Branches
+// grow at a similar rate, so that can be hundreds of entries: they are
+// shifted with one memmove, and the old slot found by binary search on the
+// old key rather than through a per hash index that every shift would have
+// to rewrite.
+namespace flat {
+
+using eng::getHash;
+using eng::hash_value;
+using eng::Result;
+using eng::SetItem;
+
+std::vector<uint32_t> volumes;
+std::vector<uint64_t> ranked; // SetItem keys, descending
+
+static void init() {
+  volumes.assign(131071, 0);
+  ranked.clear();
+  ranked.reserve(26 * 26 * 100);
+}
+
+// O(log n) to find both slots plus an O(k) memmove, k entries overtaken
+static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
+                                int count) {
+
+  hash_value hash = getHash(countryCode, branchNumber);
+  auto current_volume = volumes[hash.value];
+  uint32_t new_volume = current_volume + count;
+  volumes[hash.value] = new_volume;
+
+  SetItem item;
+  item.hash = hash;
+  item.volume = current_volume;
+
+  // A first sale enters at the bottom with volume 0
+  if (current_volume == 0) {
+    ranked.push_back(item.key);
+  }
+  auto old_slot = std::lower_bound(ranked.begin(), ranked.end(), item.key,
+                                   std::greater<>());
+
+  item.volume = new_volume;
+  auto new_slot =
+      std::lower_bound(ranked.begin(), old_slot, item.key, std::greater<>());
+  std::move_backward(new_slot, old_slot, old_slot + 1);
+  *new_slot = item.key;
+}
+
+// O(top), one sequential pass over the front of the array
+static std::vector<Result> get_top_branches(int top) {
+  std::vector<Result> result;
+
+  int size = std::min(static_cast<size_t>(top), ranked.size());
+
+  result.resize(size);
+
+  for (int i = 0; i < size; ++i) {
+
+    SetItem item;
+    item.key = ranked[i];
+
+    result[i].countryCode[0] = char(item.hash.cc1) + 'A';
+    result[i].countryCode[1] = char(item.hash.cc2) + 'A';
+    result[i].branchNumber = item.hash.bn;
+    result[i].carsSold = item.volume;
+  }
+
+  return result;
+}
+} // namespace flat
+
+BENCHMARK_DEFINE_F(SaleFixture, flat_impl)(benchmark::State &state) {
+  flat::init();
+  size_t i = 0;
+  for (auto _ : state) {
+    const auto &sale = getSale(state, i++);
+    flat::record_vehicle_sale(sale.countryCode, sale.branchNumber, sale.count);
+    auto res = flat::get_top_branches(sale.top);
+    benchmark::DoNotOptimize(res);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_REGISTER_F(SaleFixture, flat_impl);
+
+// eng volumes without an ordered structure. Sales only bump a counter and
+// mark the branch dirty; a query refreshes the cached top-K from the dirty
+// branches. Volumes only grow, so a branch that is neither dirty nor in the
+// previous top-K can't have entered it.
+namespace lazy {
+
+using eng::getHash;
+using eng::hash_value;
+using eng::Result;
+using eng::SetItem;
+
+std::vector<uint32_t> volumes;
+std::vector<uint8_t> dirty;   // per hash
+std::vector<uint32_t> marked; // dirty hashes
+std::vector<uint32_t> seen;   // every hash with a sale
+std::vector<uint64_t> ranked; // top-K SetItem keys, descending
+size_t cached = 0;            // K, ranked is exact for queries up to it
+
+static void init() {
+  volumes.assign(131071, 0);
+  dirty.assign(131071, 0);
+  marked.clear();
+  seen.clear();
+  ranked.clear();
+  cached = 0;
+}
+
+static uint64_t key(uint32_t hash) {
+  SetItem item;
+  item.hash.value = hash;
+  item.volume = volumes[hash];
+  return item.key;
+}
+
+// O(1)
+static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
+                                int count) {
+
+  hash_value hash = getHash(countryCode, branchNumber);
+  if (volumes[hash.value] == 0) {
+    seen.push_back(hash.value);
+  }
+  volumes[hash.value] += count;
+  if (!dirty[hash.value]) {
+    dirty[hash.value] = 1;
+    marked.push_back(hash.value);
+  }
+}
+
+// Best k of keys, sorted descending. O(n + k log k)
+static void select_top(std::vector<uint64_t> &keys, size_t k) {
+  if (keys.size() > k) {
+    std::nth_element(keys.begin(), keys.begin() + k, keys.end(),
+                     std::greater<>());
+    keys.resize(k);
+  }
+  std::sort(keys.begin(), keys.end(), std::greater<>());
+}
+
+// O(K + d log d) for d dirty branches, O(n + K log K) when K grows
+static void refresh(size_t top) {
+  std::vector<uint64_t> fresh;
+
+  if (top > cached) {
+    cached = top;
+    fresh.reserve(seen.size());
+    for (uint32_t hash : seen) {
+      fresh.push_back(key(hash));
+    }
+    ranked.clear();
+  } else {
+    fresh.reserve(marked.size());
+    for (uint32_t hash : marked) {
+      fresh.push_back(key(hash));
+    }
+    // Dirty entries of the old top-K come back through fresh
+    ranked.erase(std::remove_if(ranked.begin(), ranked.end(),
+                                [](uint64_t key) {
+                                  SetItem item;
+                                  item.key = key;
+                                  return dirty[item.hash.value] != 0;
+                                }),
+                 ranked.end());
+  }
+
+  for (uint32_t hash : marked) {
+    dirty[hash] = 0;
+  }
+  marked.clear();
+
+  select_top(fresh, cached);
+  std::vector<uint64_t> merged(ranked.size() + fresh.size());
+  std::merge(ranked.begin(), ranked.end(), fresh.begin(), fresh.end(),
+             merged.begin(), std::greater<>());
+  merged.resize(std::min(merged.size(), cached));
+  ranked = std::move(merged);
+}
+
+static std::vector<Result> get_top_branches(int top) {
+  if (!marked.empty() || static_cast<size_t>(top) > cached) {
+    refresh(top);
+  }
+
+  std::vector<Result> result;
+
+  int size = std::min(static_cast<size_t>(top), ranked.size());
+
+  result.resize(size);
+
+  for (int i = 0; i < size; ++i) {
+
+    SetItem item;
+    item.key = ranked[i];
+
+    result[i].countryCode[0] = char(item.hash.cc1) + 'A';
+    result[i].countryCode[1] = char(item.hash.cc2) + 'A';
+    result[i].branchNumber = item.hash.bn;
+    result[i].carsSold = item.volume;
+  }
+
+  return result;
+}
+} // namespace lazy
+
+BENCHMARK_DEFINE_F(SaleFixture, lazy_impl)(benchmark::State &state) {
+  lazy::init();
+  size_t i = 0;
+  for (auto _ : state) {
+    const auto &sale = getSale(state, i++);
+    lazy::record_vehicle_sale(sale.countryCode, sale.branchNumber, sale.count);
+    auto res = lazy::get_top_branches(sale.top);
+    benchmark::DoNotOptimize(res);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_REGISTER_F(SaleFixture, lazy_impl);
+
+// range(0) queries for every range(1) sales
+template <typename Record, typename Query>
+static void read_write_mix(SaleFixture &fixture, benchmark::State &state,
+                           Record record, Query query) {
+  const int reads = state.range(0);
+  const int writes = state.range(1);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    for (int w = 0; w < writes; ++w) {
+      const auto &sale = fixture.getSale(state, i++);
+      record(sale.countryCode, sale.branchNumber, sale.count);
+    }
+    for (int r = 0; r < reads; ++r) {
+      auto res = query(fixture.getSale(state, i++).top);
+      benchmark::DoNotOptimize(res);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (reads + writes));
+}
+
+#define BENCH_MIX(test)                                                        \
+  BENCHMARK_REGISTER_F(SaleFixture, test)                                      \
+      ->ArgNames({"reads", "writes"})                                          \
+      ->Args({1, 1})                                                           \
+      ->Args({1, 100})                                                         \
+      ->Args({100, 1});
+
+BENCHMARK_DEFINE_F(SaleFixture, eng_mix)(benchmark::State &state) {
+  eng::init();
+  read_write_mix(*this, state, eng::record_vehicle_sale,
+                 eng::get_top_branches);
+}
+
+BENCH_MIX(eng_mix);
+
+BENCHMARK_DEFINE_F(SaleFixture, flat_mix)(benchmark::State &state) {
+  flat::init();
+  read_write_mix(*this, state, flat::record_vehicle_sale,
+                 flat::get_top_branches);
+}
+
+BENCH_MIX(flat_mix);
+
+BENCHMARK_DEFINE_F(SaleFixture, lazy_mix)(benchmark::State &state) {
+  lazy::init();
+  read_write_mix(*this, state, lazy::record_vehicle_sale,
+                 lazy::get_top_branches);
+}
+
+BENCH_MIX(lazy_mix);
+
+// eng ranking over a sliding window instead of all time. The window is a
+// ring of buckets, one per interval of bucket_length clock units, each with
+// its own volumes and the branches it touched. Moving into a new interval
+// subtracts the bucket that falls out of the window from the totals and
+// reuses it, so expiry costs one update per branch in that bucket.
+namespace windowed {
+
+using eng::getHash;
+using eng::hash_value;
+using eng::Result;
+using eng::SetItem;
+
+struct Bucket {
+  std::vector<uint32_t> volumes;
+  std::vector<uint32_t> touched;
+};
+
+std::vector<Bucket> buckets;
+uint64_t bucket_length = 1;
+uint64_t current_interval = 0;
+
+std::vector<uint32_t> volumes; // window totals
+std::set<uint64_t, std::greater<>> ccbnSet;
+
+static void init(size_t window_buckets, uint64_t length) {
+  buckets.assign(window_buckets, Bucket{std::vector<uint32_t>(131071), {}});
+  bucket_length = length;
+  current_interval = 0;
+  volumes.assign(131071, 0);
+  ccbnSet.clear();
+}
+
+// O(log n), branches leave the set when their window total drops to 0
+static void set_volume(hash_value hash, uint32_t new_volume) {
+  SetItem item;
+  item.hash = hash;
+  item.volume = volumes[hash.value];
+  volumes[hash.value] = new_volume;
+
+  std::set<uint64_t, std::greater<>>::node_type set_node;
+  if (item.volume != 0) {
+    set_node = ccbnSet.extract(item.key);
+  }
+  if (new_volume == 0) {
+    return;
+  }
+  item.volume = new_volume;
+  if (!set_node.empty()) {
+    set_node.value() = item.key;
+    ccbnSet.insert(std::move(set_node));
+  } else {
+    ccbnSet.insert(item.key);
+  }
+}
+
+// O(t log n) for t branches sold in the expired bucket
+static void expire(Bucket &bucket) {
+  for (uint32_t value : bucket.touched) {
+    hash_value hash;
+    hash.value = value;
+    set_volume(hash, volumes[value] - bucket.volumes[value]);
+    bucket.volumes[value] = 0;
+  }
+  bucket.touched.clear();
+}
+
+// Reuses the bucket of every interval that ends the window before now
+static void advance(uint64_t now) {
+  uint64_t interval = now / bucket_length;
+  if (interval <= current_interval) {
+    return;
+  }
+  uint64_t first = std::max(current_interval + 1,
+                            interval + 1 - std::min<uint64_t>(interval + 1,
+                                                              buckets.size()));
+  for (uint64_t i = first; i <= interval; ++i) {
+    expire(buckets[i % buckets.size()]);
+  }
+  current_interval = interval;
+}
+
+// O(log n) amortized, plus expiry when now enters a new interval
+static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
+                                int count, uint64_t now) {
+  advance(now);
+
+  hash_value hash = getHash(countryCode, branchNumber);
+  Bucket &bucket = buckets[current_interval % buckets.size()];
+  if (bucket.volumes[hash.value] == 0) {
+    bucket.touched.push_back(hash.value);
+  }
+  bucket.volumes[hash.value] += count;
+  set_volume(hash, volumes[hash.value] + count);
+}
+
+// O(top) once advanced to now
+static std::vector<Result> get_top_branches(int top, uint64_t now) {
+  advance(now);
+
+  std::vector<Result> result;
+
+  int size = std::min(static_cast<size_t>(top), ccbnSet.size());
+
+  result.resize(size);
+
+  auto it = ccbnSet.begin();
+  for (int i = 0; i < size; ++i) {
+
+    SetItem item;
+    item.key = *it++;
+
+    result[i].countryCode[0] = char(item.hash.cc1) + 'A';
+    result[i].countryCode[1] = char(item.hash.cc2) + 'A';
+    result[i].branchNumber = item.hash.bn;
+    result[i].carsSold = item.volume;
+  }
+
+  return result;
+}
+
+// A full window recorded before timing starts. The clock ticks once per
+// sale, range(1) sales per bucket.
+static uint64_t fill_window(SaleFixture &fixture,
+                            const benchmark::State &state) {
+  init(state.range(0), state.range(1));
+
+  uint64_t now = 0;
+  uint64_t window = state.range(0) * state.range(1);
+  for (; now < window; ++now) {
+    const auto &sale = fixture.getSale(state, now);
+    record_vehicle_sale(sale.countryCode, sale.branchNumber, sale.count, now);
+  }
+  return now;
+}
+} // namespace windowed
+
+BENCHMARK_DEFINE_F(SaleFixture, windowed_ingest)(benchmark::State &state) {
+  uint64_t now = windowed::fill_window(*this, state);
+  for (auto _ : state) {
+    const auto &sale = getSale(state, now);
+    windowed::record_vehicle_sale(sale.countryCode, sale.branchNumber,
+                                  sale.count, now++);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_DEFINE_F(SaleFixture, windowed_query)(benchmark::State &state) {
+  uint64_t now = windowed::fill_window(*this, state);
+  size_t i = 0;
+  for (auto _ : state) {
+    auto res = windowed::get_top_branches(getSale(state, i++).top, now);
+    benchmark::DoNotOptimize(res);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+#define BENCH_WINDOW(test)                                                     \
+  BENCHMARK_REGISTER_F(SaleFixture, test)                                      \
+      ->ArgNames({"buckets", "sales_per_bucket"})                              \
+      ->ArgsProduct({{10, 60, 300}, {100, 1000}});
+
+BENCH_WINDOW(windowed_ingest);
+BENCH_WINDOW(windowed_query);
+
 BENCHMARK_MAIN();
\ No newline at end of file
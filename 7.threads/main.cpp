@@ -1,14 +1,19 @@
 #include <benchmark/benchmark.h>
 
+#include <cstdlib>
 #include <random>
 #include <string_view>
 #include <vector>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <execution>
+#include <immintrin.h>
 #include <map>
 #include <mutex>
 #include <set>
+#include <shared_mutex>
 #include <utility>
 
 class SaleFixture : public benchmark::Fixture {
@@ -36,30 +41,50 @@ class SaleFixture : public benchmark::Fixture {
       "VN", "VG", "VI", "WF", "EH", "YE", "ZM", "ZW", "AX"};
 
 public:
-  void SetUp(const ::benchmark::State &state) {}
-
-  void TearDown(const ::benchmark::State &state) {}
+  // A sale and the top N queried after it
+  struct Sale {
+    std::string_view countryCode;
+    int branchNumber;
+    int count;
+    int top;
+  };
 
-  std::string_view getCountryCode() {
-    return {country_codes[d_country_code(re)]};
+  static constexpr size_t sales_per_thread = 1 << 16;
+  static constexpr int max_threads = 64;
+
+  // Each thread draws its own buffer up front, the benchmarks cycle through
+  // it so no random numbers are drawn, or timers paused, while timing
+  void SetUp(const ::benchmark::State &state) {
+    if (state.thread_index() >= max_threads) {
+      std::abort();
+    }
+    std::seed_seq seq{seed, uint32_t(state.thread_index())};
+    std::default_random_engine re{seq};
+
+    std::uniform_int_distribution<int> d_country_code{
+        0, sizeof(country_codes) / sizeof(const char *) - 1};
+    std::uniform_int_distribution<int> d_branch_number{0, 99};
+    std::uniform_int_distribution<int> d_count{1, 50};
+    std::uniform_int_distribution<int> d_top{1, 1000};
+
+    auto &sales = buffers[state.thread_index()];
+    sales.resize(sales_per_thread);
+    for (auto &sale : sales) {
+      sale = {country_codes[d_country_code(re)], d_branch_number(re),
+              d_count(re), d_top(re)};
+    }
   }
 
-  int getBranchCode() { return d_branch_number(re); }
-
-  int count() { return d_count(re); }
+  void TearDown(const ::benchmark::State &state) {}
 
-  int getTopN() { return d_top(re); }
+  // The calling thread's i-th sale, wrapping around
+  const Sale &getSale(const ::benchmark::State &state, size_t i) const {
+    return buffers[state.thread_index()][i & (sales_per_thread - 1)];
+  }
 
 private:
-  std::random_device r;
-  std::default_random_engine re{r()};
-
-  std::uniform_int_distribution<int> d_country_code{
-      0, sizeof(country_codes) / sizeof(const char *) - 1};
-
-  std::uniform_int_distribution<int> d_branch_number{0, 99};
-  std::uniform_int_distribution<int> d_count{1, 50};
-  std::uniform_int_distribution<int> d_top{1, 1000};
+  const uint32_t seed = std::random_device{}();
+  std::vector<Sale> buffers[max_threads];
 };
 
 /*
@@ -135,17 +160,14 @@ static std::vector<Result> get_top_branches(int top) {
 } // namespace naive
 
 BENCHMARK_DEFINE_F(SaleFixture, naive_impl)(benchmark::State &state) {
+  size_t i = 0;
   for (auto _ : state) {
-    state.PauseTiming();
-    auto a = getCountryCode();
-    auto b = getBranchCode();
-    auto c = count();
-    auto d = getTopN();
-    state.ResumeTiming();
-    naive::record_vehicle_sale(a, b, c);
-    auto res = naive::get_top_branches(d);
+    const auto &sale = getSale(state, i++);
+    naive::record_vehicle_sale(sale.countryCode, sale.branchNumber, sale.count);
+    auto res = naive::get_top_branches(sale.top);
     benchmark::DoNotOptimize(res);
   }
+  state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK_REGISTER_F(SaleFixture, naive_impl)
@@ -225,17 +247,15 @@ static std::vector<Result> get_top_branches(int top) {
 } // namespace dev3years
 
 BENCHMARK_DEFINE_F(SaleFixture, dev3years_impl)(benchmark::State &state) {
+  size_t i = 0;
   for (auto _ : state) {
-    state.PauseTiming();
-    auto a = getCountryCode();
-    auto b = getBranchCode();
-    auto c = count();
-    auto d = getTopN();
-    state.ResumeTiming();
-    dev3years::record_vehicle_sale(a, b, c);
-    auto res = dev3years::get_top_branches(d);
+    const auto &sale = getSale(state, i++);
+    dev3years::record_vehicle_sale(sale.countryCode, sale.branchNumber,
+                                   sale.count);
+    auto res = dev3years::get_top_branches(sale.top);
     benchmark::DoNotOptimize(res);
   }
+  state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK_REGISTER_F(SaleFixture, dev3years_impl)
@@ -288,12 +308,8 @@ static struct eng_data {
 
 static void init() { instance.volumes.resize(131071); }
 
-static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
-                                int count) {
-
-  std::lock_guard lock(instance.mutex);
-
-  hash_value hash = getHash(countryCode, branchNumber);
+// instance.mutex held
+static void add_volume(hash_value hash, uint32_t count) {
   auto current_volume = instance.volumes[hash.value];
   uint32_t new_volume = current_volume + count;
   instance.volumes[hash.value] = new_volume;
@@ -312,6 +328,92 @@ static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
   }
 }
 
+static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
+                                int count) {
+
+  std::lock_guard lock(instance.mutex);
+
+  add_volume(getHash(countryCode, branchNumber), count);
+}
+
+// A sale as it comes off the message bus, 8 bytes
+struct Sale {
+  char countryCode[2];
+  uint16_t branchNumber;
+  uint32_t count;
+};
+
+// Hashes and counts of n sales, 4 sales per AVX2 register
+static void pack_sales(const Sale *sales, size_t n, uint32_t *hashes,
+                       uint32_t *counts) {
+  size_t i = 0;
+#ifdef __AVX2__
+  const __m256i byte = _mm256_set1_epi32(0xFF);
+  const __m256i letter = _mm256_set1_epi32('A');
+  // Hash dwords to the low half, count dwords to the high half
+  const __m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  for (; i + 4 <= n; i += 4) {
+    __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(sales + i));
+    __m256i cc1 = _mm256_sub_epi32(_mm256_and_si256(v, byte), letter);
+    __m256i cc2 = _mm256_sub_epi32(
+        _mm256_and_si256(_mm256_srli_epi32(v, 8), byte), letter);
+    __m256i bn = _mm256_srli_epi32(v, 16);
+    __m256i hash = _mm256_or_si256(
+        _mm256_or_si256(cc1, _mm256_slli_epi32(cc2, 5)),
+        _mm256_slli_epi32(bn, 10));
+    // Odd dwords hold the counts, keep them in place of the hashes
+    hash = _mm256_blend_epi32(hash, v, 0xAA);
+    hash = _mm256_permutevar8x32_epi32(hash, split);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(hashes + i),
+                     _mm256_castsi256_si128(hash));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(counts + i),
+                     _mm256_extracti128_si256(hash, 1));
+  }
+#endif
+  for (; i < n; ++i) {
+    hashes[i] = getHash({sales[i].countryCode, 2}, sales[i].branchNumber).value;
+    counts[i] = sales[i].count;
+  }
+}
+
+// Duplicates are summed in a small open addressing table first, so each
+// branch costs one set update per batch and the lock is taken once
+static void record_vehicle_sales(const Sale *sales, size_t n) {
+  thread_local std::vector<uint32_t> hashes;
+  thread_local std::vector<uint32_t> counts;
+  thread_local std::vector<uint64_t> table; // count << 32 | hash + 1
+
+  hashes.resize(n);
+  counts.resize(n);
+  pack_sales(sales, n, hashes.data(), counts.data());
+
+  int bits = 1;
+  while ((size_t(1) << bits) < n * 2) {
+    ++bits;
+  }
+  const uint32_t mask = (1u << bits) - 1;
+  table.assign(size_t(1) << bits, 0);
+
+  for (size_t i = 0; i < n; ++i) {
+    uint32_t slot = (hashes[i] * 0x9E3779B1u) >> (32 - bits);
+    while (table[slot] != 0 && uint32_t(table[slot]) != hashes[i] + 1) {
+      slot = (slot + 1) & mask;
+    }
+    table[slot] += (uint64_t(counts[i]) << 32) |
+                   (table[slot] == 0 ? hashes[i] + 1 : 0);
+  }
+
+  std::lock_guard lock(instance.mutex);
+  for (uint64_t entry : table) {
+    if (entry != 0) {
+      hash_value hash;
+      hash.value = uint32_t(entry) - 1;
+      add_volume(hash, uint32_t(entry >> 32));
+    }
+  }
+}
+
 struct Result {
   char countryCode[2];
   int branchNumber;
@@ -348,17 +450,14 @@ BENCHMARK_DEFINE_F(SaleFixture, eng_impl)(benchmark::State &state) {
   if (state.thread_index() == 0) {
     eng::init();
   }
+  size_t i = 0;
   for (auto _ : state) {
-    state.PauseTiming();
-    auto a = getCountryCode();
-    auto b = getBranchCode();
-    auto c = count();
-    auto d = getTopN();
-    state.ResumeTiming();
-    eng::record_vehicle_sale(a, b, c);
-    auto res = eng::get_top_branches(d);
+    const auto &sale = getSale(state, i++);
+    eng::record_vehicle_sale(sale.countryCode, sale.branchNumber, sale.count);
+    auto res = eng::get_top_branches(sale.top);
     benchmark::DoNotOptimize(res);
   }
+  state.SetItemsProcessed(state.iterations());
 }
 
 BENCHMARK_REGISTER_F(SaleFixture, eng_impl)
@@ -369,4 +468,542 @@ BENCHMARK_REGISTER_F(SaleFixture, eng_impl)
     ->Threads(16)
     ->UseRealTime();
 
+// eng volumes sharded per thread. A sale writes only the calling thread's
+// shard, so writers share no cache lines and take no lock. Queries read a
+// ranked snapshot that one reader at a time rebuilds from the shards, at
+// most every refresh_interval, and publishes with a pointer swap. Replaced
+// snapshots are freed once every reader that could hold them has left
+// (epoch based reclamation), so queries never wait on writers or mergers.
+// The price is a query result up to refresh_interval old.
+namespace sharded {
+
+using eng::getHash;
+using eng::hash_value;
+using eng::Result;
+using eng::SetItem;
+
+static constexpr size_t max_threads = 64;
+static constexpr size_t max_top = 1000;
+static constexpr auto refresh_interval = std::chrono::milliseconds(1);
+
+// Written by one thread at a time, the one holding its slot
+struct alignas(64) shard {
+  std::atomic<uint32_t> volumes[131072];
+  std::atomic<uint32_t> touched_count;
+  uint32_t touched[131072]; // hashes with a non zero volume in this shard
+};
+
+// Epoch a reader entered at, 0 while it holds no snapshot
+struct alignas(64) reader_epoch {
+  std::atomic<uint64_t> epoch;
+};
+
+struct snapshot {
+  std::vector<uint64_t> ranked; // top SetItem keys, descending
+};
+
+static struct sharded_data {
+  std::mutex registry_mutex;
+  bool in_use[max_threads];
+  std::atomic<shard *> shards[max_threads];
+  std::atomic<size_t> shard_count;
+
+  reader_epoch readers[max_threads];
+  std::atomic<uint64_t> epoch{1};
+  std::atomic<snapshot *> current;
+
+  std::mutex merge_mutex;
+  std::atomic<std::chrono::steady_clock::rep> published_at;
+  std::vector<std::pair<uint64_t, snapshot *>> retired;
+  std::vector<uint32_t> totals;
+} instance{};
+
+// Claims a shard and reader slot for the lifetime of the calling thread,
+// shards outlive their threads and carry on with the next one
+struct thread_slot {
+  size_t index = 0;
+  shard *own = nullptr;
+
+  thread_slot() {
+    std::lock_guard lock(instance.registry_mutex);
+    while (index < max_threads && instance.in_use[index]) {
+      ++index;
+    }
+    if (index == max_threads) {
+      std::abort();
+    }
+    instance.in_use[index] = true;
+    own = instance.shards[index].load(std::memory_order_relaxed);
+    if (own == nullptr) {
+      own = new shard{};
+      instance.shards[index].store(own, std::memory_order_release);
+    }
+    if (instance.shard_count.load(std::memory_order_relaxed) <= index) {
+      instance.shard_count.store(index + 1, std::memory_order_release);
+    }
+  }
+
+  ~thread_slot() {
+    std::lock_guard lock(instance.registry_mutex);
+    instance.in_use[index] = false;
+  }
+};
+
+static thread_slot &this_thread_slot() {
+  thread_local thread_slot slot;
+  return slot;
+}
+
+static void init() {
+  std::lock_guard lock(instance.merge_mutex);
+  if (instance.current.load() == nullptr) {
+    instance.current.store(new snapshot{});
+    instance.totals.resize(131072);
+  }
+}
+
+// O(1), plain stores to memory no other thread writes
+static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
+                                int count) {
+
+  shard &own = *this_thread_slot().own;
+
+  hash_value hash = getHash(countryCode, branchNumber);
+  auto &volume = own.volumes[hash.value];
+  uint32_t current_volume = volume.load(std::memory_order_relaxed);
+  if (current_volume == 0) {
+    uint32_t touched = own.touched_count.load(std::memory_order_relaxed);
+    own.touched[touched] = hash.value;
+    own.touched_count.store(touched + 1, std::memory_order_release);
+  }
+  volume.store(current_volume + count, std::memory_order_relaxed);
+}
+
+// O(s * b + b + K log K) for s shards and b branches, merge_mutex held
+static void publish() {
+  std::vector<uint32_t> seen;
+  auto &totals = instance.totals;
+
+  size_t shard_count = instance.shard_count.load(std::memory_order_acquire);
+  for (size_t i = 0; i < shard_count; ++i) {
+    const shard *own = instance.shards[i].load(std::memory_order_acquire);
+    uint32_t touched = own->touched_count.load(std::memory_order_acquire);
+    for (uint32_t t = 0; t < touched; ++t) {
+      uint32_t hash = own->touched[t];
+      if (totals[hash] == 0) {
+        seen.push_back(hash);
+      }
+      totals[hash] += own->volumes[hash].load(std::memory_order_relaxed);
+    }
+  }
+
+  auto *fresh = new snapshot{};
+  auto &ranked = fresh->ranked;
+  ranked.reserve(seen.size());
+  for (uint32_t hash : seen) {
+    SetItem item;
+    item.hash.value = hash;
+    item.volume = totals[hash];
+    ranked.push_back(item.key);
+    totals[hash] = 0;
+  }
+  if (ranked.size() > max_top) {
+    std::nth_element(ranked.begin(), ranked.begin() + max_top, ranked.end(),
+                     std::greater<>());
+    ranked.resize(max_top);
+  }
+  std::sort(ranked.begin(), ranked.end(), std::greater<>());
+
+  // A reader that still sees the old pointer entered at or before retired_at
+  snapshot *old = instance.current.exchange(fresh);
+  uint64_t retired_at = instance.epoch.fetch_add(1);
+  instance.retired.emplace_back(retired_at, old);
+
+  uint64_t oldest = ~uint64_t(0);
+  for (const auto &reader : instance.readers) {
+    uint64_t epoch = reader.epoch.load();
+    if (epoch != 0) {
+      oldest = std::min(oldest, epoch);
+    }
+  }
+  auto reclaimable = std::partition(
+      instance.retired.begin(), instance.retired.end(),
+      [oldest](const auto &entry) { return entry.first >= oldest; });
+  for (auto it = reclaimable; it != instance.retired.end(); ++it) {
+    delete it->second;
+  }
+  instance.retired.erase(reclaimable, instance.retired.end());
+}
+
+// O(top) on the snapshot, plus a publish() by whichever reader finds it stale
+static std::vector<Result> get_top_branches(int top) {
+  thread_slot &slot = this_thread_slot();
+
+  auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+  auto stale_at = instance.published_at.load(std::memory_order_relaxed) +
+                  std::chrono::steady_clock::duration(refresh_interval).count();
+  if (now >= stale_at && instance.merge_mutex.try_lock()) {
+    std::lock_guard lock(instance.merge_mutex, std::adopt_lock);
+    publish();
+    instance.published_at.store(now, std::memory_order_relaxed);
+  }
+
+  auto &reader = instance.readers[slot.index].epoch;
+  reader.store(instance.epoch.load());
+  const snapshot *current = instance.current.load();
+
+  std::vector<Result> result;
+
+  int size = std::min(static_cast<size_t>(top), current->ranked.size());
+
+  result.resize(size);
+
+  for (int i = 0; i < size; ++i) {
+
+    SetItem item;
+    item.key = current->ranked[i];
+    char c1 = char(item.hash.cc1) + 'A';
+    char c2 = char(item.hash.cc2) + 'A';
+
+    result[i].countryCode[0] = c1;
+    result[i].countryCode[1] = c2;
+    result[i].branchNumber = item.hash.bn;
+    result[i].carsSold = item.volume;
+  }
+
+  reader.store(0, std::memory_order_release);
+  return result;
+}
+} // namespace sharded
+
+BENCHMARK_DEFINE_F(SaleFixture, sharded_impl)(benchmark::State &state) {
+  if (state.thread_index() == 0) {
+    sharded::init();
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    const auto &sale = getSale(state, i++);
+    sharded::record_vehicle_sale(sale.countryCode, sale.branchNumber,
+                                 sale.count);
+    auto res = sharded::get_top_branches(sale.top);
+    benchmark::DoNotOptimize(res);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_REGISTER_F(SaleFixture, sharded_impl)
+    ->Threads(1)
+    ->Threads(2)
+    ->Threads(4)
+    ->Threads(8)
+    ->Threads(16)
+    ->UseRealTime();
+
+// eng with a reader-writer lock, queries run concurrently with each other
+namespace eng_rw {
+
+using eng::getHash;
+using eng::hash_value;
+using eng::Result;
+using eng::SetItem;
+
+static struct eng_data {
+  std::shared_mutex mutex;
+  std::vector<uint32_t> volumes;
+  std::set<uint64_t, std::greater<>> ccbnSet;
+} instance{};
+
+static void init() { instance.volumes.resize(131071); }
+
+static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
+                                int count) {
+
+  std::unique_lock lock(instance.mutex);
+
+  hash_value hash = getHash(countryCode, branchNumber);
+  auto current_volume = instance.volumes[hash.value];
+  uint32_t new_volume = current_volume + count;
+  instance.volumes[hash.value] = new_volume;
+
+  SetItem item;
+  item.hash = hash;
+  item.volume = current_volume;
+
+  auto set_node = instance.ccbnSet.extract(item.key);
+  item.volume = new_volume;
+  if (!set_node.empty()) {
+    set_node.value() = item.key;
+    instance.ccbnSet.insert(std::move(set_node));
+  } else {
+    instance.ccbnSet.insert(item.key);
+  }
+}
+
+static std::vector<Result> get_top_branches(int top) {
+  std::vector<Result> result;
+
+  std::shared_lock lock(instance.mutex);
+  int size = std::min(static_cast<size_t>(top), instance.ccbnSet.size());
+
+  result.resize(size);
+
+  auto it = instance.ccbnSet.begin();
+  for (int i = 0; i < size; ++i) {
+
+    SetItem item;
+    item.key = *it++;
+    char c1 = char(item.hash.cc1) + 'A';
+    char c2 = char(item.hash.cc2) + 'A';
+
+    result[i].countryCode[0] = c1;
+    result[i].countryCode[1] = c2;
+    result[i].branchNumber = item.hash.bn;
+    result[i].carsSold = item.volume;
+  }
+
+  return result;
+}
+} // namespace eng_rw
+
+// eng with queries served from a fixed size top-K array under a seqlock.
+// Writers serialize on a mutex, keep every key in a rank ordered array and
+// rewrite only the top-K slots a sale moved. Readers take no lock: they
+// copy optimistically and retry if the sequence changed meanwhile.
+namespace eng_seqlock {
+
+using eng::getHash;
+using eng::hash_value;
+using eng::Result;
+using eng::SetItem;
+
+static constexpr size_t max_top = 1000;
+
+static struct eng_data {
+  std::mutex mutex;
+  std::vector<uint32_t> volumes;
+  std::vector<uint64_t> ranked; // every SetItem key, descending
+
+  alignas(64) std::atomic<uint64_t> sequence; // odd while a write is open
+  std::atomic<uint32_t> size;
+  std::atomic<uint64_t> top[max_top]; // copy of the front of ranked
+} instance{};
+
+static void init() {
+  instance.volumes.resize(131071);
+  instance.ranked.reserve(26 * 26 * 100);
+}
+
+// O(log n + k), k entries overtaken, top-K slots rewritten only for k <= K
+static void record_vehicle_sale(std::string_view countryCode, int branchNumber,
+                                int count) {
+
+  std::lock_guard lock(instance.mutex);
+
+  hash_value hash = getHash(countryCode, branchNumber);
+  auto current_volume = instance.volumes[hash.value];
+  uint32_t new_volume = current_volume + count;
+  instance.volumes[hash.value] = new_volume;
+
+  SetItem item;
+  item.hash = hash;
+  item.volume = current_volume;
+
+  auto &ranked = instance.ranked;
+  if (current_volume == 0) {
+    ranked.push_back(item.key);
+  }
+  auto old_slot = std::lower_bound(ranked.begin(), ranked.end(), item.key,
+                                   std::greater<>());
+
+  item.volume = new_volume;
+  auto new_slot =
+      std::lower_bound(ranked.begin(), old_slot, item.key, std::greater<>());
+  std::move_backward(new_slot, old_slot, old_slot + 1);
+  *new_slot = item.key;
+
+  size_t first = new_slot - ranked.begin();
+  size_t last = std::min<size_t>(old_slot - ranked.begin() + 1, max_top);
+  if (first >= last) {
+    return;
+  }
+
+  uint64_t sequence = instance.sequence.load(std::memory_order_relaxed);
+  instance.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = first; i < last; ++i) {
+    instance.top[i].store(ranked[i], std::memory_order_relaxed);
+  }
+  instance.size.store(std::min(ranked.size(), max_top),
+                      std::memory_order_relaxed);
+  instance.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// O(top) per attempt, retried while writers touch the top-K
+static std::vector<Result> get_top_branches(int top) {
+  std::vector<Result> result;
+  std::vector<uint64_t> keys;
+  keys.reserve(std::min(static_cast<size_t>(top), max_top));
+
+  for (;;) {
+    uint64_t sequence = instance.sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      continue;
+    }
+    size_t size = std::min<size_t>(
+        top, instance.size.load(std::memory_order_relaxed));
+    keys.clear();
+    for (size_t i = 0; i < size; ++i) {
+      keys.push_back(instance.top[i].load(std::memory_order_relaxed));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (instance.sequence.load(std::memory_order_relaxed) == sequence) {
+      break;
+    }
+  }
+
+  int size = keys.size();
+
+  result.resize(size);
+
+  for (int i = 0; i < size; ++i) {
+
+    SetItem item;
+    item.key = keys[i];
+    char c1 = char(item.hash.cc1) + 'A';
+    char c2 = char(item.hash.cc2) + 'A';
+
+    result[i].countryCode[0] = c1;
+    result[i].countryCode[1] = c2;
+    result[i].branchNumber = item.hash.bn;
+    result[i].carsSold = item.volume;
+  }
+
+  return result;
+}
+} // namespace eng_seqlock
+
+// Every thread runs the same number of iterations, so an iteration is a
+// slice of wall time in which the thread repeats its role as often as it can.
+// Both roles stay busy for the whole run and their rates vary independently
+static constexpr auto role_slice = std::chrono::microseconds(200);
+
+// The first range(0) threads only query, the others only record
+template <typename Record, typename Query>
+static void split_roles(SaleFixture &fixture, benchmark::State &state,
+                        Record record, Query query) {
+  const bool reader = state.thread_index() < state.range(0);
+  size_t i = 0;
+  for (auto _ : state) {
+    const auto until = std::chrono::steady_clock::now() + role_slice;
+    do {
+      const auto &sale = fixture.getSale(state, i++);
+      if (reader) {
+        auto res = query(sale.top);
+        benchmark::DoNotOptimize(res);
+      } else {
+        record(sale.countryCode, sale.branchNumber, sale.count);
+      }
+    } while (std::chrono::steady_clock::now() < until);
+  }
+  state.counters[reader ? "queries" : "sales"] =
+      benchmark::Counter(double(i), benchmark::Counter::kIsRate);
+}
+
+#define BENCH_ROLES(test)                                                      \
+  BENCHMARK_REGISTER_F(SaleFixture, test)                                      \
+      ->ArgName("readers")                                                     \
+      ->Arg(1)                                                                 \
+      ->Arg(4)                                                                 \
+      ->Arg(7)                                                                 \
+      ->Threads(8)                                                             \
+      ->UseRealTime();
+
+BENCHMARK_DEFINE_F(SaleFixture, eng_roles)(benchmark::State &state) {
+  if (state.thread_index() == 0) {
+    eng::init();
+  }
+  split_roles(*this, state, eng::record_vehicle_sale, eng::get_top_branches);
+}
+
+BENCH_ROLES(eng_roles);
+
+BENCHMARK_DEFINE_F(SaleFixture, eng_rw_roles)(benchmark::State &state) {
+  if (state.thread_index() == 0) {
+    eng_rw::init();
+  }
+  split_roles(*this, state, eng_rw::record_vehicle_sale,
+              eng_rw::get_top_branches);
+}
+
+BENCH_ROLES(eng_rw_roles);
+
+BENCHMARK_DEFINE_F(SaleFixture, eng_seqlock_roles)(benchmark::State &state) {
+  if (state.thread_index() == 0) {
+    eng_seqlock::init();
+  }
+  split_roles(*this, state, eng_seqlock::record_vehicle_sale,
+              eng_seqlock::get_top_branches);
+}
+
+BENCH_ROLES(eng_seqlock_roles);
+
+// The calling thread's sales in the eng::Sale wire format
+static std::vector<eng::Sale> wire_sales(const SaleFixture &fixture,
+                                         const benchmark::State &state) {
+  std::vector<eng::Sale> sales(SaleFixture::sales_per_thread);
+  for (size_t i = 0; i < sales.size(); ++i) {
+    const auto &sale = fixture.getSale(state, i);
+    sales[i] = {{sale.countryCode[0], sale.countryCode[1]},
+                uint16_t(sale.branchNumber),
+                uint32_t(sale.count)};
+  }
+  return sales;
+}
+
+// range(0) consecutive sales of the thread's buffer per batch
+BENCHMARK_DEFINE_F(SaleFixture, eng_batch)(benchmark::State &state) {
+  if (state.thread_index() == 0) {
+    eng::init();
+  }
+  const auto sales = wire_sales(*this, state);
+  const size_t batch = state.range(0);
+  size_t offset = 0;
+  for (auto _ : state) {
+    eng::record_vehicle_sales(sales.data() + offset, batch);
+    offset = (offset + batch) % (sales.size() - batch + 1);
+  }
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+// Baseline, the same batches one record_vehicle_sale at a time
+BENCHMARK_DEFINE_F(SaleFixture, eng_unbatched)(benchmark::State &state) {
+  if (state.thread_index() == 0) {
+    eng::init();
+  }
+  const auto sales = wire_sales(*this, state);
+  const size_t batch = state.range(0);
+  size_t offset = 0;
+  for (auto _ : state) {
+    for (size_t i = offset; i < offset + batch; ++i) {
+      eng::record_vehicle_sale({sales[i].countryCode, 2},
+                               sales[i].branchNumber, sales[i].count);
+    }
+    offset = (offset + batch) % (sales.size() - batch + 1);
+  }
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+#define BENCH_BATCH(test)                                                      \
+  BENCHMARK_REGISTER_F(SaleFixture, test)                                      \
+      ->ArgName("batch")                                                       \
+      ->RangeMultiplier(4)                                                     \
+      ->Range(1, 4096)                                                         \
+      ->Threads(1)                                                             \
+      ->Threads(4)                                                             \
+      ->Threads(16)                                                            \
+      ->UseRealTime();
+
+BENCH_BATCH(eng_batch);
+BENCH_BATCH(eng_unbatched);
+
 BENCHMARK_MAIN();
\ No newline at end of file